@@ -0,0 +1,127 @@
+/* Benchmark: memory and speed of the compact queue against a regular queue
+ *
+ * The same random strings, KEY_LEN bytes each, go into a regular queue and
+ * into a cqueue.  The heap growth of each is measured with mallinfo2(), so
+ * it includes malloc and harness headers and the slack of the cqueue pools,
+ * and the two are sorted and freed.  Freeing includes the harness filling
+ * every freed byte, which for the cqueue means its whole pools.  The number
+ * of elements is the first argument, 10M by default.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "cqueue.h"
+#include "harness.h"
+#include "queue.h"
+
+#define NITEMS 10000000
+#define KEY_LEN 10
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Large blocks are mapped on their own and counted apart */
+static size_t heap_bytes()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+/* Own generator, since the harness draws from rand() on every malloc */
+static uint64_t seed;
+
+static void random_key(element_t *probe, char *key)
+{
+    for (int k = 0; k < KEY_LEN; k++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        key[k] = 'a' + (seed >> 33) % 26;
+    }
+    probe->value = key;
+    probe->type = Q_STR;
+    q_element_setkey(probe, KEY_LEN);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : NITEMS;
+    char key[KEY_LEN + 1] = {0};
+    element_t probe;
+
+    seed = 1;
+    size_t base = heap_bytes();
+    double t = now();
+    struct list_head *q = q_new();
+    for (long i = 0; q && i < n; i++) {
+        random_key(&probe, key);
+        if (!q_insert_tail(q, key))
+            q = NULL;
+    }
+    double q_build = now() - t;
+    size_t q_mem = heap_bytes() - base;
+
+    seed = 1;
+    base = heap_bytes();
+    t = now();
+    cqueue_t *cq = cq_new(Q_STR);
+    for (long i = 0; cq && i < n; i++) {
+        random_key(&probe, key);
+        if (!cq_insert_tail(cq, &probe))
+            cq = NULL;
+    }
+    double cq_build = now() - t;
+    size_t cq_mem = heap_bytes() - base;
+    if (!q || !cq) {
+        fprintf(stderr, "ERROR: Could not build queues of %ld elements\n", n);
+        return 1;
+    }
+
+    t = now();
+    q_sort(q, false);
+    double q_sorted = now() - t;
+    t = now();
+    cq_sort(cq, false);
+    double cq_sorted = now() - t;
+
+    /* Both sorts are stable, so the queues must match element for element */
+    bool same = true;
+    char buf[KEY_LEN + 1];
+    element_t *e;
+    list_for_each_entry (e, q, list) {
+        element_t got;
+        if (!cq_remove_head(cq, &got, buf, sizeof(buf)) ||
+            !q_element_equal(e, &got)) {
+            same = false;
+            break;
+        }
+    }
+    same = same && !cq_size(cq);
+
+    t = now();
+    q_free(q);
+    double q_freed = now() - t;
+    t = now();
+    cq_free(cq);
+    double cq_freed = now() - t;
+
+    if (!same) {
+        fprintf(stderr, "ERROR: Sorted queues differ\n");
+        return 1;
+    }
+    printf("%ld strings of %d bytes\n", n, KEY_LEN);
+    printf("%-8s %12s %10s %10s %10s\n", "layout", "bytes/elem", "build ms",
+           "sort ms", "free ms");
+    printf("%-8s %12.1f %10.1f %10.1f %10.1f\n", "list", (double) q_mem / n,
+           1e3 * q_build, 1e3 * q_sorted, 1e3 * q_freed);
+    printf("%-8s %12.1f %10.1f %10.1f %10.1f\n", "cqueue", (double) cq_mem / n,
+           1e3 * cq_build, 1e3 * cq_sorted, 1e3 * cq_freed);
+    return 0;
+}
@@ -0,0 +1,78 @@
+/* Benchmark: latency of freeing a queue in place versus in the background
+ *
+ * Queues of several sizes are freed with q_free(), then handed to a
+ * reclaimer thread with q_free_async().  The caller only waits for the
+ * hand-over, so its latency is reported next to the time the reclaimer
+ * needed to release everything.  Every block has to be back by the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+#include "tpool.h"
+
+#define KEY_LEN 10
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static struct list_head *build(int n)
+{
+    char key[KEY_LEN + 1] = {0};
+    struct list_head *q = q_new();
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < KEY_LEN; k++)
+            key[k] = 'a' + rand() % 26;
+        q_insert_tail(q, key);
+    }
+    return q;
+}
+
+int main()
+{
+    static const int sizes[] = {1000, 100000, 1000000, 2000000};
+    int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    tpool_t *reclaimer = tpool_new(1);
+    if (!reclaimer) {
+        fprintf(stderr, "ERROR: Could not start the reclaimer\n");
+        return 1;
+    }
+
+    srand(1);
+    printf("%-8s %12s %12s %12s\n", "elements", "q_free ms", "async us",
+           "reclaim ms");
+    for (int s = 0; s < nsizes; s++) {
+        struct list_head *q = build(sizes[s]);
+        double t = now();
+        q_free(q);
+        double sync = now() - t;
+
+        q = build(sizes[s]);
+        t = now();
+        q_free_async(q, reclaimer);
+        double handover = now() - t;
+        tpool_wait(reclaimer);
+        double reclaim = now() - t;
+
+        printf("%-8d %12.2f %12.2f %12.2f\n", sizes[s], 1e3 * sync,
+               1e6 * handover, 1e3 * reclaim);
+    }
+    tpool_free(reclaimer);
+
+    size_t left = allocation_check();
+    if (left) {
+        fprintf(stderr, "ERROR: %zu blocks still allocated\n", left);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* Benchmark: overhead of journaling queue operations
+ *
+ * A mix of insertions, removals and reversals runs on a queue without a
+ * journal and then journaled with several group commit sizes.  Groups of
+ * one record sync on every operation, so they run fewer operations.  Each
+ * journal is then replayed and checked against the queue it was written
+ * for.
+ *
+ * The journal lives in the directory given as the first argument, "." by
+ * default; syncs cost next to nothing on a tmpfs such as /tmp.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "journal.h"
+#include "queue.h"
+
+#define NOPS 200000
+#define KEY_LEN 12
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static bool same_queue(struct list_head *a, struct list_head *b)
+{
+    struct list_head *x = a->next, *y = b->next;
+    for (; x != a && y != b; x = x->next, y = y->next) {
+        if (!q_element_equal(list_entry(x, element_t, list),
+                             list_entry(y, element_t, list)))
+            return false;
+    }
+    return x == a && y == b;
+}
+
+/* Run nops operations on q, journaled to j unless it is NULL */
+static bool run(struct list_head *q, journal_t *j, int nops)
+{
+    char key[KEY_LEN + 1] = {0};
+    srand(1);
+    for (int i = 0; i < nops; i++) {
+        bool ok = true;
+        if (i % 4 == 3) {
+            element_t *e = q_remove_head(q, NULL, 0);
+            if (e)
+                q_release_element(e);
+            ok = !j || journal_op(j, J_REMOVE_HEAD, 0);
+        } else if (i % 1000 == 999) {
+            q_reverse(q);
+            ok = !j || journal_op(j, J_REVERSE, 0);
+        } else {
+            for (int k = 0; k < KEY_LEN; k++)
+                key[k] = 'a' + rand() % 26;
+            ok = q_insert_tail(q, key) &&
+                 (!j || journal_insert(j, true, list_last_entry(
+                                                    q, element_t, list)));
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        int group, div;
+    } configs[] = {{-1, 1}, {0, 1}, {64, 1}, {8, 8}, {1, 64}};
+    int nconfigs = sizeof(configs) / sizeof(configs[0]);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/lab0-journal-%d",
+             argc > 1 ? argv[1] : ".", (int) getpid());
+
+    printf("%-6s %8s %10s %10s %8s %10s\n", "group", "ops", "ms", "ns/op",
+           "syncs", "replay ms");
+    bool ok = true;
+    for (int c = 0; c < nconfigs; c++) {
+        int group = configs[c].group, nops = NOPS / configs[c].div;
+        struct list_head *q = q_new();
+        journal_t *j = group < 0 ? NULL : journal_open(path, q, group, 0);
+        if (group >= 0 && !j) {
+            fprintf(stderr, "ERROR: Could not create journal %s\n", path);
+            return 1;
+        }
+
+        double t = now();
+        bool done = run(q, j, nops) && (!j || journal_sync(j));
+        t = now() - t;
+        uint64_t syncs = j ? journal_stats(j).syncs : 0;
+        bool journaled = j;
+        done = journal_close(j) && done;
+
+        double replay = 0;
+        if (journaled && done) {
+            struct list_head *copy = q_new();
+            replay = now();
+            journal_t *r = journal_open(path, copy, 1, 0);
+            replay = now() - replay;
+            done = r && same_queue(q, copy);
+            journal_close(r);
+            q_free(copy);
+        }
+        if (journaled)
+            journal_unlink(path);
+        q_free(q);
+
+        if (!done) {
+            fprintf(stderr, "ERROR: Journal of group %d failed\n", group);
+            ok = false;
+            continue;
+        }
+        if (group < 0)
+            printf("%-6s %8d %10.2f %10.1f %8s %10s\n", "none", nops, 1e3 * t,
+                   1e9 * t / nops, "", "");
+        else
+            printf("%-6d %8d %10.2f %10.1f %8" PRIu64 " %10.2f\n", group, nops,
+                   1e3 * t, 1e9 * t / nops, syncs, 1e3 * replay);
+    }
+    return ok ? 0 : 1;
+}
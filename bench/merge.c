@@ -0,0 +1,133 @@
+/* Benchmark: q_merge() versus q_merge_parallel(), sweeping the workers
+ *
+ * NQUEUES sorted queues of QUEUE_LEN keys drawn from a small alphabet, so
+ * that equal keys spread over many queues.  Every run merges clones of the
+ * same chain.  A clone shares the value buffers of its original, which
+ * identifies every element, so the parallel result is checked to be the
+ * serial one element for element, ties included, in both orders.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+#include "tpool.h"
+
+#define NQUEUES 64
+#define QUEUE_LEN 20000
+#define KEY_LEN 4
+
+static struct list_head *queues[NQUEUES];
+static queue_contex_t ctx[NQUEUES];
+static struct list_head chain;
+static const char **expect;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void fill_queues(bool descend)
+{
+    char key[KEY_LEN + 1] = {0};
+    srand(1);
+    for (int i = 0; i < NQUEUES; i++) {
+        q_free(queues[i]);
+        queues[i] = q_new();
+        for (int n = 0; n < QUEUE_LEN; n++) {
+            for (int k = 0; k < KEY_LEN; k++)
+                key[k] = 'a' + rand() % 4;
+            q_insert_tail(queues[i], key);
+        }
+        q_sort(queues[i], descend);
+    }
+}
+
+/* Build the chain from clones of the queues */
+static void clone_chain()
+{
+    INIT_LIST_HEAD(&chain);
+    for (int i = 0; i < NQUEUES; i++) {
+        ctx[i].q = q_clone(queues[i]);
+        ctx[i].size = QUEUE_LEN;
+        ctx[i].id = i;
+        list_add_tail(&ctx[i].chain, &chain);
+    }
+}
+
+static void free_chain()
+{
+    for (int i = 0; i < NQUEUES; i++)
+        q_free(ctx[i].q);
+}
+
+static double merge(tpool_t *pool, bool descend)
+{
+    clone_chain();
+    double t = now();
+    int len = pool ? q_merge_parallel(&chain, descend, pool)
+                   : q_merge(&chain, descend);
+    t = now() - t;
+
+    bool ok = len == NQUEUES * QUEUE_LEN;
+    element_t *e;
+    int i = 0;
+    list_for_each_entry (e, ctx[0].q, list) {
+        if (!pool)
+            expect[i] = e->value;
+        else if (expect[i] != e->value)
+            ok = false;
+        i++;
+    }
+    free_chain();
+    return ok && i == len ? t : -1;
+}
+
+int main()
+{
+    static const int workers[] = {1, 2, 4, 8};
+    int nsweep = sizeof(workers) / sizeof(workers[0]);
+    bool ok = true;
+
+    expect = malloc(NQUEUES * QUEUE_LEN * sizeof(*expect));
+    if (!expect)
+        return 1;
+
+    printf("%-8s %-8s %10s %8s\n", "order", "workers", "merge ms",
+           "speedup");
+    for (int d = 0; d < 2; d++) {
+        const char *order = d ? "descend" : "ascend";
+        fill_queues(d);
+        double base = merge(NULL, d);
+        printf("%-8s %-8s %10.2f %8s\n", order, "serial", 1e3 * base, "");
+        for (int i = 0; i < nsweep; i++) {
+            tpool_t *pool = tpool_new(workers[i]);
+            if (!pool) {
+                fprintf(stderr, "ERROR: Could not start %d workers\n",
+                        workers[i]);
+                return 1;
+            }
+            double t = merge(pool, d);
+            tpool_free(pool);
+            if (t < 0) {
+                fprintf(stderr, "ERROR: %s merge with %d workers differs\n",
+                        order, workers[i]);
+                ok = false;
+                continue;
+            }
+            printf("%-8s %-8d %10.2f %8.2f\n", order, workers[i], 1e3 * t,
+                   base / t);
+        }
+    }
+
+    for (int i = 0; i < NQUEUES; i++)
+        q_free(queues[i]);
+    free(expect);
+    return ok ? 0 : 1;
+}
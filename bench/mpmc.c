@@ -0,0 +1,233 @@
+/* Stress test and throughput benchmark: lock-free MPMC queue
+ *
+ * P producers each insert their share of NITEMS strings "<producer>:<seq>"
+ * while C consumers remove strings until all of them are consumed.  Every
+ * run is checked: each consumer must see the strings of one producer in
+ * increasing order, and the sum of all sequence numbers must match.
+ *
+ * The same workload runs against the list_head queue behind a mutex,
+ * which is what the lock-free queue replaces.  Both allocate through the
+ * test harness, which must hold no block once a run is over.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "mpmc.h"
+#include "queue.h"
+
+#define NITEMS (1 << 19)
+#define MAX_PRODUCERS 16
+#define VALUE_LEN 32
+
+typedef struct {
+    const char *name;
+    void *(*create)();
+    void (*destroy)(void *q);
+    bool (*insert)(void *q, const char *s);
+    bool (*remove)(void *q, char *sp, size_t bufsize);
+} queue_ops_t;
+
+/* list_head queue serialized by one lock */
+typedef struct {
+    pthread_mutex_t lock;
+    struct list_head *q;
+} locked_t;
+
+static void *locked_create()
+{
+    locked_t *l = malloc(sizeof(locked_t));
+    pthread_mutex_init(&l->lock, NULL);
+    l->q = q_new();
+    return l;
+}
+
+static void locked_destroy(void *q)
+{
+    locked_t *l = q;
+    q_free(l->q);
+    pthread_mutex_destroy(&l->lock);
+    free(l);
+}
+
+static bool locked_insert(void *q, const char *s)
+{
+    locked_t *l = q;
+    pthread_mutex_lock(&l->lock);
+    bool ok = q_insert_tail(l->q, (char *) s);
+    pthread_mutex_unlock(&l->lock);
+    return ok;
+}
+
+static bool locked_remove(void *q, char *sp, size_t bufsize)
+{
+    locked_t *l = q;
+    pthread_mutex_lock(&l->lock);
+    element_t *e = q_remove_head(l->q, sp, bufsize);
+    if (e)
+        q_release_element(e);
+    pthread_mutex_unlock(&l->lock);
+    return e;
+}
+
+static void *mpmc_create()
+{
+    return mpmc_new();
+}
+
+static void mpmc_destroy(void *q)
+{
+    mpmc_free(q);
+}
+
+static bool mpmc_insert(void *q, const char *s)
+{
+    return mpmc_insert_tail(q, s);
+}
+
+static bool mpmc_remove(void *q, char *sp, size_t bufsize)
+{
+    return mpmc_remove_head(q, sp, bufsize);
+}
+
+static const queue_ops_t impls[] = {
+    {"lock-free", mpmc_create, mpmc_destroy, mpmc_insert, mpmc_remove},
+    {"mutex", locked_create, locked_destroy, locked_insert, locked_remove},
+};
+
+typedef struct {
+    const queue_ops_t *ops;
+    void *q;
+    int producers;
+    atomic_long consumed;
+    atomic_llong seq_sum;
+    atomic_bool failed;
+} run_t;
+
+typedef struct {
+    run_t *run;
+    int id;
+} worker_t;
+
+static void *producer(void *arg)
+{
+    worker_t *w = arg;
+    run_t *run = w->run;
+    char buf[VALUE_LEN];
+
+    for (long s = w->id; s < NITEMS; s += run->producers) {
+        snprintf(buf, sizeof(buf), "%d:%ld", w->id, s);
+        while (!run->ops->insert(run->q, buf))
+            ;
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    worker_t *w = arg;
+    run_t *run = w->run;
+    long last[MAX_PRODUCERS];
+    long long sum = 0;
+    char buf[VALUE_LEN];
+    for (int i = 0; i < MAX_PRODUCERS; i++)
+        last[i] = -1;
+    while (atomic_load(&run->consumed) < NITEMS) {
+        if (!run->ops->remove(run->q, buf, sizeof(buf))) {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add(&run->consumed, 1);
+        int p;
+        long s;
+        if (sscanf(buf, "%d:%ld", &p, &s) != 2 || p < 0 ||
+            p >= run->producers || s <= last[p]) {
+            fprintf(stderr, "ERROR: %s: unexpected value '%s'\n",
+                    run->ops->name, buf);
+            atomic_store(&run->failed, true);
+            continue;
+        }
+        last[p] = s;
+        sum += s;
+    }
+    atomic_fetch_add(&run->seq_sum, sum);
+    return NULL;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Return throughput in million operations per second, or -1 on failure */
+static double run_once(const queue_ops_t *ops, int producers, int consumers)
+{
+    run_t run = {.ops = ops, .q = ops->create(), .producers = producers};
+    pthread_t tid[2 * MAX_PRODUCERS];
+    worker_t w[2 * MAX_PRODUCERS];
+    int n = producers + consumers;
+
+    double t = now();
+    for (int i = 0; i < n; i++) {
+        w[i].run = &run;
+        w[i].id = i < producers ? i : i - producers;
+        pthread_create(&tid[i], NULL, i < producers ? producer : consumer,
+                       &w[i]);
+    }
+    for (int i = 0; i < n; i++)
+        pthread_join(tid[i], NULL);
+    t = now() - t;
+
+    char buf[VALUE_LEN];
+    bool leftover = ops->remove(run.q, buf, sizeof(buf));
+    ops->destroy(run.q);
+    size_t leaked = allocation_check();
+
+    long long expect = (long long) NITEMS * (NITEMS - 1) / 2;
+    if (atomic_load(&run.failed) || leftover ||
+        atomic_load(&run.seq_sum) != expect) {
+        fprintf(stderr, "ERROR: %s: %dP/%dC lost or duplicated values\n",
+                ops->name, producers, consumers);
+        return -1;
+    }
+    if (leaked) {
+        fprintf(stderr, "ERROR: %s: %dP/%dC leaked %zu blocks\n", ops->name,
+                producers, consumers, leaked);
+        return -1;
+    }
+    return 2.0 * NITEMS / t / 1e6;
+}
+
+int main()
+{
+    static const int shapes[][2] = {{1, 1}, {1, 4}, {4, 1},
+                                    {2, 2}, {4, 4}, {8, 8}};
+    int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+    bool ok = true;
+
+    printf("%-4s %-4s", "P", "C");
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+        printf(" %12s", impls[i].name);
+    printf("   (million operations per second)\n");
+
+    for (int s = 0; s < nshapes; s++) {
+        printf("%-4d %-4d", shapes[s][0], shapes[s][1]);
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            double mops = run_once(&impls[i], shapes[s][0], shapes[s][1]);
+            ok = ok && mops >= 0;
+            printf(" %12.2f", mops);
+        }
+        printf("\n");
+    }
+    return ok ? 0 : 1;
+}
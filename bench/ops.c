@@ -0,0 +1,77 @@
+/* Benchmark: the cost of the test harness to the queue operations
+ *
+ * Builds a queue of random strings, sorts, clones and reverses it, drains
+ * half of it from the head and frees the rest.  bench/ops runs the queue
+ * through the harness allocator, bench/ops-standalone links the same code
+ * from libqueue, built with QUEUE_STANDALONE and the C library allocator.
+ * The number of elements is the first argument, 1M by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef QUEUE_STANDALONE
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#endif
+#include "queue.h"
+
+#define NITEMS 1000000
+#define KEY_LEN 10
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : NITEMS;
+    char key[KEY_LEN + 1] = {0};
+    double t[6];
+
+    srand(1);
+    t[0] = now();
+    struct list_head *q = q_new();
+    for (long i = 0; q && i < n; i++) {
+        for (int k = 0; k < KEY_LEN; k++)
+            key[k] = 'a' + rand() % 26;
+        if (!q_insert_tail(q, key)) {
+            q_free(q);
+            q = NULL;
+        }
+    }
+    if (!q) {
+        fprintf(stderr, "ERROR: Could not build a queue of %ld elements\n", n);
+        return 1;
+    }
+    t[1] = now();
+    q_sort(q, false);
+    t[2] = now();
+    struct list_head *copy = q_clone(q);
+    q_reverse(copy);
+    t[3] = now();
+    for (long i = 0; i < n / 2; i++) {
+        element_t *e = q_remove_head(q, NULL, 0);
+        q_release_element(e);
+    }
+    t[4] = now();
+    q_free(q);
+    q_free(copy);
+    t[5] = now();
+
+#ifdef QUEUE_STANDALONE
+    printf("%ld elements, libqueue\n", n);
+#else
+    printf("%ld elements, test harness\n", n);
+#endif
+    const char *phase[] = {"insert", "sort", "clone", "remove", "free"};
+    for (int i = 0; i < 5; i++)
+        printf("%-8s %10.1f ms\n", phase[i], 1e3 * (t[i + 1] - t[i]));
+    printf("%-8s %10.1f ms\n", "total", 1e3 * (t[5] - t[0]));
+    return 0;
+}
@@ -0,0 +1,171 @@
+/* Microbenchmark: min-max heap priority queue versus sort-then-remove
+ *
+ * Three workloads over random string and integer keys:
+ *   batch:  insert n values, then remove all of them in ascending order.
+ *   events: keep n values queued and repeatedly insert one value and remove
+ *           the minimum, as an event or task scheduler does.  The list
+ *           queue has to be sorted again before each removal.
+ *   both:   insert n values, then remove them alternating between the
+ *           minimum and the maximum.  The list queue is sorted once and
+ *           removes from its head and tail.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "pqueue.h"
+#include "queue.h"
+
+#define BATCH_N 200000
+#define EVENTS_N 50000
+#define EVENTS_OPS 2000
+#define KEY_LEN 12
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static char key[KEY_LEN + 1];
+
+static element_t *rand_element(q_type_t type)
+{
+    if (type == Q_INT)
+        return q_element_new_int(((int64_t) rand() << 31) ^ rand());
+    for (int i = 0; i < KEY_LEN; i++)
+        key[i] = 'a' + rand() % 26;
+    return q_element_new(Q_STR, key, KEY_LEN);
+}
+
+static void fill_pq(pqueue_t *pq, q_type_t type, int n)
+{
+    for (int i = 0; i < n; i++) {
+        element_t *e = rand_element(type);
+        if (!pq_push(pq, e))
+            q_release_element(e);
+    }
+}
+
+static void fill_queue(struct list_head *q, q_type_t type, int n)
+{
+    for (int i = 0; i < n; i++)
+        list_add_tail(&rand_element(type)->list, q);
+}
+
+static double batch_pq(q_type_t type)
+{
+    pqueue_t pq;
+    pq_init(&pq);
+    srand(1);
+    double t = now();
+    fill_pq(&pq, type, BATCH_N);
+    element_t *e;
+    while ((e = q_pop_min(&pq)))
+        q_release_element(e);
+    return now() - t;
+}
+
+static double batch_sort(q_type_t type)
+{
+    struct list_head *q = q_new();
+    srand(1);
+    double t = now();
+    fill_queue(q, type, BATCH_N);
+    q_sort(q, false);
+    element_t *e;
+    while ((e = q_remove_head(q, NULL, 0)))
+        q_release_element(e);
+    t = now() - t;
+    q_free(q);
+    return t;
+}
+
+static double both_pq(q_type_t type)
+{
+    pqueue_t pq;
+    pq_init(&pq);
+    srand(3);
+    double t = now();
+    fill_pq(&pq, type, BATCH_N);
+    element_t *e;
+    for (int i = 0; (e = i & 1 ? q_pop_max(&pq) : q_pop_min(&pq)); i++)
+        q_release_element(e);
+    return now() - t;
+}
+
+static double both_sort(q_type_t type)
+{
+    struct list_head *q = q_new();
+    srand(3);
+    double t = now();
+    fill_queue(q, type, BATCH_N);
+    q_sort(q, false);
+    element_t *e;
+    for (int i = 0; (e = i & 1 ? q_remove_tail(q, NULL, 0)
+                               : q_remove_head(q, NULL, 0));
+         i++)
+        q_release_element(e);
+    t = now() - t;
+    q_free(q);
+    return t;
+}
+
+static double events_pq(q_type_t type)
+{
+    pqueue_t pq;
+    pq_init(&pq);
+    srand(2);
+    fill_pq(&pq, type, EVENTS_N);
+    double t = now();
+    for (int i = 0; i < EVENTS_OPS; i++) {
+        fill_pq(&pq, type, 1);
+        q_release_element(q_pop_min(&pq));
+    }
+    t = now() - t;
+    pq_free(&pq);
+    return t;
+}
+
+static double events_sort(q_type_t type)
+{
+    struct list_head *q = q_new();
+    srand(2);
+    fill_queue(q, type, EVENTS_N);
+    double t = now();
+    for (int i = 0; i < EVENTS_OPS; i++) {
+        list_add_tail(&rand_element(type)->list, q);
+        q_sort(q, false);
+        q_release_element(q_remove_head(q, NULL, 0));
+    }
+    t = now() - t;
+    q_free(q);
+    return t;
+}
+
+int main()
+{
+    static const q_type_t types[] = {Q_STR, Q_INT};
+    static const char *const names[] = {"str", "int"};
+
+    printf("%-6s %-8s %12s %12s\n", "type", "workload", "min-max heap",
+           "sort+rh/rt");
+    for (int i = 0; i < 2; i++) {
+        printf("%-6s %-8s %11.2fms %11.2fms\n", names[i], "batch",
+               1e3 * batch_pq(types[i]), 1e3 * batch_sort(types[i]));
+        printf("%-6s %-8s %11.2fus %11.2fus\n", names[i], "events",
+               1e6 * events_pq(types[i]) / EVENTS_OPS,
+               1e6 * events_sort(types[i]) / EVENTS_OPS);
+        printf("%-6s %-8s %11.2fms %11.2fms\n", names[i], "both",
+               1e3 * both_pq(types[i]), 1e3 * both_sort(types[i]));
+    }
+    printf("(batch, both: %d values in total, events: per operation with %d "
+           "values queued)\n",
+           BATCH_N, EVENTS_N);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/* Two-process benchmark: shared-memory queue versus a pipe
+ *
+ * A forked producer streams NITEMS numbered strings to the parent, which
+ * checks that they arrive complete and in order.  The shared queue is
+ * attached by name in the child, as an unrelated process would; the pipe
+ * carries each string with a one-byte length prefix.  Runs are repeated
+ * for a few string lengths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmq.h"
+
+#define NITEMS (1 << 19)
+#define SEGMENT_SIZE (1 << 20)
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* String number i, padded with letters to len characters */
+static void make_value(char *buf, int i, int len)
+{
+    int n = snprintf(buf, len + 1, "%d", i);
+    memset(buf + n, 'a' + i % 26, len - n);
+    buf[len] = '\0';
+}
+
+static bool check_value(const char *value, int i, int len)
+{
+    char expect[256];
+    make_value(expect, i, len);
+    return !strcmp(value, expect);
+}
+
+static int produce_shm(const char *name, int len)
+{
+    shmq_t *q = shmq_attach(name);
+    if (!q)
+        return 1;
+    char value[256];
+    for (int i = 0; i < NITEMS; i++) {
+        make_value(value, i, len);
+        if (!shmq_insert_tail(q, value))
+            return 1;
+    }
+    shmq_close(q);
+    shmq_detach(q);
+    return 0;
+}
+
+static bool write_all(int fd, const char *buf, size_t n)
+{
+    while (n) {
+        ssize_t w = write(fd, buf, n);
+        if (w <= 0)
+            return false;
+        buf += w;
+        n -= w;
+    }
+    return true;
+}
+
+static bool read_all(int fd, char *buf, size_t n)
+{
+    while (n) {
+        ssize_t r = read(fd, buf, n);
+        if (r <= 0)
+            return false;
+        buf += r;
+        n -= r;
+    }
+    return true;
+}
+
+/* Strings are written in chunks, as a stdio stream would */
+static int produce_pipe(int fd, int len)
+{
+    char chunk[4096], value[256];
+    size_t used = 0;
+    for (int i = 0; i < NITEMS; i++) {
+        if (used + len + 1 > sizeof(chunk)) {
+            if (!write_all(fd, chunk, used))
+                return 1;
+            used = 0;
+        }
+        make_value(value, i, len);
+        chunk[used++] = (char) len;
+        memcpy(chunk + used, value, len);
+        used += len;
+    }
+    bool ok = write_all(fd, chunk, used);
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+/* Return the seconds taken, negative for a failure */
+static double run_shm(int len)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/lab0-bench-%d", (int) getpid());
+    shmq_t *q = shmq_create(name, SEGMENT_SIZE);
+    if (!q)
+        return -1;
+
+    double t = now();
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(produce_shm(name, len));
+
+    bool ok = pid > 0;
+    char value[256];
+    int i = 0;
+    while (ok && shmq_remove_head(q, value, sizeof(value)))
+        ok = check_value(value, i++, len);
+    t = now() - t;
+
+    int status = 1;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+    shmq_detach(q);
+    shmq_unlink(name);
+    return ok && i == NITEMS && !status ? t : -1;
+}
+
+static double run_pipe(int len)
+{
+    int fd[2];
+    if (pipe(fd))
+        return -1;
+
+    double t = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        _exit(produce_pipe(fd[1], len));
+    }
+    close(fd[1]);
+
+    /* Read in chunks as well, taking strings out of the buffer */
+    bool ok = pid > 0;
+    char buf[8192], value[256];
+    size_t have = 0, pos = 0;
+    int i = 0;
+    while (ok && i < NITEMS) {
+        if (have - pos < (size_t) len + 1) {
+            memmove(buf, buf + pos, have - pos);
+            have -= pos;
+            pos = 0;
+            ssize_t r = read(fd[0], buf + have, sizeof(buf) - have);
+            if (r <= 0)
+                break;
+            have += r;
+            continue;
+        }
+        size_t n = (unsigned char) buf[pos++];
+        memcpy(value, buf + pos, n);
+        value[n] = '\0';
+        pos += n;
+        ok = check_value(value, i++, len);
+    }
+    ok = ok && pos == have && !read_all(fd[0], buf, 1);
+    t = now() - t;
+    close(fd[0]);
+
+    int status = 1;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+    return ok && i == NITEMS && !status ? t : -1;
+}
+
+int main()
+{
+    static const int lens[] = {8, 32, 128};
+    int nlens = sizeof(lens) / sizeof(lens[0]);
+    bool ok = true;
+
+    printf("%-6s %-6s %10s %12s\n", "len", "chan", "ms", "Mstrings/s");
+    for (int i = 0; i < nlens; i++) {
+        double s = run_shm(lens[i]);
+        double p = run_pipe(lens[i]);
+        if (s < 0 || p < 0) {
+            fprintf(stderr, "ERROR: Transfer of %d-byte strings failed\n",
+                    lens[i]);
+            ok = false;
+            continue;
+        }
+        printf("%-6d %-6s %10.2f %12.2f\n", lens[i], "shm", 1e3 * s,
+               NITEMS / s / 1e6);
+        printf("%-6d %-6s %10.2f %12.2f\n", lens[i], "pipe", 1e3 * p,
+               NITEMS / p / 1e6);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+/* Benchmark: rebuilding a large queue versus loading it from a snapshot
+ *
+ * NITEMS random strings are inserted as "it RAND" does, the queue is saved
+ * with q_save(), and q_load() maps it back.  The loaded queue is checked
+ * against the original element by element.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+
+#define NITEMS 1000000
+#define KEY_LEN 10
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static bool same_queue(struct list_head *a, struct list_head *b)
+{
+    struct list_head *x = a->next, *y = b->next;
+    for (; x != a && y != b; x = x->next, y = y->next) {
+        if (!q_element_equal(list_entry(x, element_t, list),
+                             list_entry(y, element_t, list)))
+            return false;
+    }
+    return x == a && y == b;
+}
+
+int main()
+{
+    char path[64], key[KEY_LEN + 1] = {0};
+    snprintf(path, sizeof(path), "/tmp/lab0-snapshot-%d", (int) getpid());
+
+    srand(1);
+    double t = now();
+    struct list_head *q = q_new();
+    for (int i = 0; i < NITEMS; i++) {
+        for (int k = 0; k < KEY_LEN; k++)
+            key[k] = 'a' + rand() % 26;
+        q_insert_tail(q, key);
+    }
+    double build = now() - t;
+
+    t = now();
+    bool ok = q_save(q, path);
+    double save = now() - t;
+
+    t = now();
+    struct list_head *copy = ok ? q_load(path) : NULL;
+    double load = now() - t;
+    ok = copy && same_queue(q, copy);
+    remove(path);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Loaded queue differs from the saved one\n");
+        return 1;
+    }
+    printf("%-8s %10s %8s\n", "step", "ms", "vs build");
+    printf("%-8s %10.2f %8s\n", "build", 1e3 * build, "");
+    printf("%-8s %10.2f %8.2f\n", "save", 1e3 * save, build / save);
+    printf("%-8s %10.2f %8.2f\n", "load", 1e3 * load, build / load);
+
+    q_free(q);
+    q_free(copy);
+    return 0;
+}
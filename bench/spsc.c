@@ -0,0 +1,230 @@
+/* Two-thread benchmark: SPSC ring versus the list_head queue
+ *
+ * Throughput: one producer streams NITEMS numbered strings to one consumer,
+ * which checks that they arrive in order.  The ring is driven one string
+ * at a time and in batches of BATCH; the list_head queue sits behind a
+ * mutex.
+ *
+ * Latency: two threads bounce a string through a pair of queues and the
+ * mean round trip is reported.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+#include "spsc.h"
+
+#define NITEMS (1 << 20)
+#define ROUND_TRIPS 20000
+#define CAPACITY 1024
+#define BATCH 32
+#define VALUE_LEN 24
+
+typedef enum { RING, RING_BATCH, LOCKED } chan_mode_t;
+static const char *const mode_names[] = {"ring", "ring/batch", "mutex"};
+
+/* list_head queue serialized by one lock */
+typedef struct {
+    pthread_mutex_t lock;
+    struct list_head *q;
+} locked_t;
+
+static bool locked_insert(locked_t *l, const char *s)
+{
+    pthread_mutex_lock(&l->lock);
+    bool ok = q_insert_tail(l->q, (char *) s);
+    pthread_mutex_unlock(&l->lock);
+    return ok;
+}
+
+static bool locked_remove(locked_t *l, char *sp, size_t bufsize)
+{
+    pthread_mutex_lock(&l->lock);
+    element_t *e = q_remove_head(l->q, sp, bufsize);
+    if (e)
+        q_release_element(e);
+    pthread_mutex_unlock(&l->lock);
+    return e;
+}
+
+typedef struct {
+    chan_mode_t mode;
+    spsc_t *ring;
+    locked_t locked;
+    bool failed;
+} channel_t;
+
+static void channel_init(channel_t *c, chan_mode_t mode)
+{
+    c->mode = mode;
+    c->ring = spsc_new(CAPACITY);
+    pthread_mutex_init(&c->locked.lock, NULL);
+    c->locked.q = q_new();
+    c->failed = false;
+}
+
+static void channel_destroy(channel_t *c)
+{
+    spsc_free(c->ring);
+    q_free(c->locked.q);
+    pthread_mutex_destroy(&c->locked.lock);
+}
+
+static void chan_send(channel_t *c, const char *s)
+{
+    if (c->mode == LOCKED) {
+        while (!locked_insert(&c->locked, s))
+            ;
+    } else {
+        while (!spsc_insert_tail(c->ring, s))
+            ;
+    }
+}
+
+static void chan_receive(channel_t *c, char *buf)
+{
+    if (c->mode == LOCKED) {
+        while (!locked_remove(&c->locked, buf, VALUE_LEN))
+            sched_yield();
+    } else {
+        spsc_remove_head(c->ring, buf, VALUE_LEN);
+    }
+}
+
+static void *producer(void *arg)
+{
+    channel_t *c = arg;
+    char bufs[BATCH][VALUE_LEN];
+    const char *batch[BATCH];
+
+    for (long i = 0; i < NITEMS;) {
+        if (c->mode != RING_BATCH) {
+            snprintf(bufs[0], VALUE_LEN, "%ld", i++);
+            chan_send(c, bufs[0]);
+            continue;
+        }
+        int n = 0;
+        for (; n < BATCH && i + n < NITEMS; n++) {
+            snprintf(bufs[n], VALUE_LEN, "%ld", i + n);
+            batch[n] = bufs[n];
+        }
+        size_t done = 0;
+        while (done < (size_t) n) {
+            size_t k = spsc_insert_batch(c->ring, batch + done, n - done);
+            if (!k)
+                sched_yield();
+            done += k;
+        }
+        i += n;
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    channel_t *c = arg;
+    char bufs[BATCH][VALUE_LEN];
+    char *sp[BATCH];
+    for (int i = 0; i < BATCH; i++)
+        sp[i] = bufs[i];
+
+    for (long i = 0; i < NITEMS;) {
+        size_t n = 1;
+        if (c->mode == RING_BATCH) {
+            n = spsc_remove_batch(c->ring, sp, VALUE_LEN, BATCH);
+            if (!n) {
+                sched_yield();
+                continue;
+            }
+        } else {
+            chan_receive(c, bufs[0]);
+        }
+        for (size_t k = 0; k < n; k++, i++) {
+            if (strtol(bufs[k], NULL, 10) != i)
+                c->failed = true;
+        }
+    }
+    return NULL;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Return million strings per second, or -1 if they arrived out of order */
+static double throughput(chan_mode_t mode)
+{
+    channel_t c;
+    channel_init(&c, mode);
+    pthread_t p, q;
+    double t = now();
+    pthread_create(&p, NULL, producer, &c);
+    pthread_create(&q, NULL, consumer, &c);
+    pthread_join(p, NULL);
+    pthread_join(q, NULL);
+    t = now() - t;
+    bool failed = c.failed;
+    channel_destroy(&c);
+    return failed ? -1 : NITEMS / t / 1e6;
+}
+
+static channel_t ping, pong;
+
+static void *echo(void *arg)
+{
+    char buf[VALUE_LEN];
+    for (int i = 0; i < ROUND_TRIPS; i++) {
+        chan_receive(&ping, buf);
+        chan_send(&pong, buf);
+    }
+    return NULL;
+}
+
+/* Return mean round trip in nanoseconds */
+static double latency(chan_mode_t mode)
+{
+    char buf[VALUE_LEN];
+    channel_init(&ping, mode);
+    channel_init(&pong, mode);
+    pthread_t t;
+    pthread_create(&t, NULL, echo, NULL);
+    double start = now();
+    for (int i = 0; i < ROUND_TRIPS; i++) {
+        chan_send(&ping, "ping");
+        chan_receive(&pong, buf);
+    }
+    double elapsed = now() - start;
+    pthread_join(t, NULL);
+    channel_destroy(&ping);
+    channel_destroy(&pong);
+    return elapsed * 1e9 / ROUND_TRIPS;
+}
+
+int main()
+{
+    bool ok = true;
+
+    printf("%-12s %14s %14s\n", "queue", "Mstrings/s", "round trip ns");
+    for (chan_mode_t m = RING; m <= LOCKED; m++) {
+        double mops = throughput(m);
+        ok = ok && mops >= 0;
+        if (m == RING_BATCH)
+            printf("%-12s %14.2f %14s\n", mode_names[m], mops, "-");
+        else
+            printf("%-12s %14.2f %14.0f\n", mode_names[m], mops, latency(m));
+    }
+    if (!ok)
+        fprintf(stderr, "ERROR: strings arrived out of order\n");
+    return ok ? 0 : 1;
+}
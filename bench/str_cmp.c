@@ -0,0 +1,117 @@
+/* Microbenchmark: per-compare cost of the string comparison kernels
+ *
+ * Compares pairs of strings sharing a common prefix of varying length, as
+ * produced by sorting and duplicate removal on similar keys, and reports
+ * nanoseconds per comparison for strcmp(), memcmp() and every str_simd
+ * kernel the CPU supports.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "str_simd.h"
+
+#define NPAIRS 4096
+#define ROUNDS 2000
+
+static char *pa[NPAIRS], *pb[NPAIRS];
+static size_t plen[NPAIRS];
+static volatile int sink;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Pairs of length len that first differ at a random position */
+static void prepare(size_t len)
+{
+    for (int i = 0; i < NPAIRS; i++) {
+        pa[i] = realloc(pa[i], len + 1);
+        pb[i] = realloc(pb[i], len + 1);
+        for (size_t j = 0; j < len; j++)
+            pa[i][j] = pb[i][j] = 'a' + rand() % 26;
+        pa[i][len] = pb[i][len] = '\0';
+        if (len && rand() % 4) {
+            size_t pos = len / 2 + rand() % (len - len / 2);
+            pb[i][pos] = pa[i][pos] == 'z' ? 'a' : pa[i][pos] + 1;
+        }
+        plen[i] = len;
+    }
+}
+
+static double bench_strcmp()
+{
+    int acc = 0;
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = 0; i < NPAIRS; i++)
+            acc += strcmp(pa[i], pb[i]) > 0;
+    t = now() - t;
+    sink = acc;
+    return t * 1e9 / ((double) ROUNDS * NPAIRS);
+}
+
+static double bench_memcmp()
+{
+    int acc = 0;
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = 0; i < NPAIRS; i++)
+            acc += memcmp(pa[i], pb[i], plen[i]) > 0;
+    t = now() - t;
+    sink = acc;
+    return t * 1e9 / ((double) ROUNDS * NPAIRS);
+}
+
+static double bench_kernel(bool eq)
+{
+    int acc = 0;
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = 0; i < NPAIRS; i++)
+            acc += eq ? str_simd_eq(pa[i], pb[i], plen[i])
+                      : str_simd_cmp(pa[i], pb[i], plen[i]) > 0;
+    t = now() - t;
+    sink = acc;
+    return t * 1e9 / ((double) ROUNDS * NPAIRS);
+}
+
+int main()
+{
+    static const size_t lengths[] = {8,    16,   32,   64,  256,
+                                     1024, 2048, 4096, 8192};
+    str_simd_t kinds[] = {STR_SIMD_SCALAR, STR_SIMD_SSE2, STR_SIMD_AVX2};
+
+    srand(1);
+    printf("%-6s %8s %8s", "len", "strcmp", "memcmp");
+    for (int k = 0; k < 3; k++) {
+        if (str_simd_select(kinds[k]))
+            printf(" %8s %8s", str_simd_name(kinds[k]), "eq");
+    }
+    printf("   (ns per compare)\n");
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        prepare(lengths[l]);
+        printf("%-6zu %8.2f %8.2f", lengths[l], bench_strcmp(),
+               bench_memcmp());
+        for (int k = 0; k < 3; k++) {
+            if (!str_simd_select(kinds[k]))
+                continue;
+            double c = bench_kernel(false);
+            double e = bench_kernel(true);
+            printf(" %8.2f %8.2f", c, e);
+        }
+        printf("\n");
+    }
+
+    for (int i = 0; i < NPAIRS; i++) {
+        free(pa[i]);
+        free(pb[i]);
+    }
+    return 0;
+}
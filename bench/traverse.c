@@ -0,0 +1,146 @@
+/* Benchmark: list traversal with and without prefetching ahead
+ *
+ * NITEMS random strings are inserted and then sorted, which leaves the
+ * nodes in an order unrelated to where they were allocated, as in a queue
+ * that has lived for a while.  Each loop runs once in the plain list.h
+ * form and once with the prefetching iterators, which also hint the value
+ * buffer of the entry LIST_PREFETCH_DISTANCE nodes ahead.  The free loops
+ * build a fresh queue every round.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+
+#define NITEMS 1000000
+#define KEY_LEN 10
+#define ROUNDS 3
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static struct list_head *build()
+{
+    char key[KEY_LEN + 1] = {0};
+    struct list_head *q = q_new();
+    for (int i = 0; i < NITEMS; i++) {
+        for (int k = 0; k < KEY_LEN; k++)
+            key[k] = 'a' + rand() % 26;
+        q_insert_tail(q, key);
+    }
+    q_sort(q, false);
+    return q;
+}
+
+static long count_plain(struct list_head *q)
+{
+    long n = 0;
+    struct list_head *node;
+    list_for_each (node, q)
+        n++;
+    return n;
+}
+
+static long count_prefetch(struct list_head *q)
+{
+    long n = 0;
+    struct list_head *node, *ahead;
+    list_for_each_prefetch (node, ahead, q)
+        n++;
+    return n;
+}
+
+static long sum_plain(struct list_head *q)
+{
+    long sum = 0;
+    element_t *e;
+    list_for_each_entry (e, q, list)
+        sum += e->value[0];
+    return sum;
+}
+
+static long sum_prefetch(struct list_head *q)
+{
+    long sum = 0;
+    element_t *e;
+    struct list_head *ahead;
+    list_for_each_entry_prefetch (e, ahead, q, list) {
+        if (ahead != q)
+            list_prefetch(list_entry(ahead, element_t, list)->value);
+        sum += e->value[0];
+    }
+    return sum;
+}
+
+/* q_free() as it was before it prefetched */
+static void free_plain(struct list_head *q)
+{
+    element_t *e, *safe;
+    list_for_each_entry_safe (e, safe, q, list)
+        q_release_element(e);
+    test_free(q);
+}
+
+static double best(double a, double b)
+{
+    return a < b ? a : b;
+}
+
+int main()
+{
+    srand(1);
+    struct list_head *q = build();
+    double t_count[2] = {1e9, 1e9}, t_sum[2] = {1e9, 1e9};
+    double t_free[2] = {1e9, 1e9};
+    long check[2] = {0, 0};
+    for (int r = 0; r < ROUNDS; r++) {
+        double t = now();
+        check[0] += count_plain(q);
+        t_count[0] = best(t_count[0], now() - t);
+        t = now();
+        check[1] += count_prefetch(q);
+        t_count[1] = best(t_count[1], now() - t);
+
+        t = now();
+        check[0] += sum_plain(q);
+        t_sum[0] = best(t_sum[0], now() - t);
+        t = now();
+        check[1] += sum_prefetch(q);
+        t_sum[1] = best(t_sum[1], now() - t);
+    }
+    q_free(q);
+
+    for (int r = 0; r < ROUNDS; r++) {
+        q = build();
+        double t = now();
+        free_plain(q);
+        t_free[0] = best(t_free[0], now() - t);
+        q = build();
+        t = now();
+        q_free(q);
+        t_free[1] = best(t_free[1], now() - t);
+    }
+
+    if (check[0] != check[1] || allocation_check()) {
+        fprintf(stderr, "ERROR: Traversals disagree or blocks leaked\n");
+        return 1;
+    }
+    printf("%d elements, prefetch distance %d, best of %d\n", NITEMS,
+           LIST_PREFETCH_DISTANCE, ROUNDS);
+    printf("%-8s %10s %10s %8s\n", "loop", "plain ms", "ahead ms", "speedup");
+    const char *names[] = {"count", "values", "free"};
+    double *times[] = {t_count, t_sum, t_free};
+    for (int i = 0; i < 3; i++)
+        printf("%-8s %10.2f %10.2f %7.2fx\n", names[i], 1e3 * times[i][0],
+               1e3 * times[i][1], times[i][0] / times[i][1]);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/* Benchmark: work-stealing thread pool, sweeping the number of workers
+ *
+ * chain sort: NQUEUES queues of QUEUE_LEN random strings are sorted as one
+ *             task per queue, like psort in qtest.
+ * fork-join:  a binary tree of tasks FORK_DEPTH deep, where every task
+ *             spawns its children from inside the pool and the leaves do
+ *             a little arithmetic.  Only stealing spreads this load.
+ *
+ * Both workloads are checked: sorted queues and the number of leaves run.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Buffers of the benchmark itself do not need the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+#include "tpool.h"
+
+#define NQUEUES 64
+#define QUEUE_LEN 20000
+#define KEY_LEN 12
+#define FORK_DEPTH 16
+#define LEAF_WORK 2000
+
+static struct list_head *queues[NQUEUES];
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void fill_queues()
+{
+    char key[KEY_LEN + 1] = {0};
+    srand(1);
+    for (int i = 0; i < NQUEUES; i++) {
+        q_free(queues[i]);
+        queues[i] = q_new();
+        for (int n = 0; n < QUEUE_LEN; n++) {
+            for (int k = 0; k < KEY_LEN; k++)
+                key[k] = 'a' + rand() % 26;
+            q_insert_tail(queues[i], key);
+        }
+    }
+}
+
+static bool queues_sorted()
+{
+    for (int i = 0; i < NQUEUES; i++) {
+        struct list_head *cur;
+        list_for_each (cur, queues[i]) {
+            if (cur->next != queues[i] &&
+                q_element_cmp(list_entry(cur, element_t, list),
+                              list_entry(cur->next, element_t, list)) > 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void sort_task(void *arg)
+{
+    q_sort(arg, false);
+}
+
+static double chain_sort(tpool_t *pool)
+{
+    fill_queues();
+    double t = now();
+    for (int i = 0; i < NQUEUES; i++)
+        tpool_submit(pool, sort_task, queues[i]);
+    tpool_wait(pool);
+    t = now() - t;
+    return queues_sorted() ? t : -1;
+}
+
+static tpool_t *fork_pool;
+static atomic_long leaves;
+static atomic_uint sink;
+
+static void fork_task(void *arg)
+{
+    intptr_t depth = (intptr_t) arg;
+    if (depth) {
+        tpool_submit(fork_pool, fork_task, (void *) (depth - 1));
+        tpool_submit(fork_pool, fork_task, (void *) (depth - 1));
+        return;
+    }
+    uint32_t x = (uint32_t) (uintptr_t) &depth;
+    for (int i = 0; i < LEAF_WORK; i++)
+        x = x * 1664525 + 1013904223;
+    atomic_store_explicit(&sink, x, memory_order_relaxed);
+    atomic_fetch_add(&leaves, 1);
+}
+
+static double fork_join(tpool_t *pool)
+{
+    fork_pool = pool;
+    atomic_store(&leaves, 0);
+    double t = now();
+    tpool_submit(pool, fork_task, (void *) (intptr_t) FORK_DEPTH);
+    tpool_wait(pool);
+    t = now() - t;
+    return atomic_load(&leaves) == 1L << FORK_DEPTH ? t : -1;
+}
+
+int main()
+{
+    static const int workers[] = {1, 2, 4, 8};
+    int nsweep = sizeof(workers) / sizeof(workers[0]);
+    double base_sort = 0, base_fork = 0;
+    bool ok = true;
+
+    printf("%-8s %14s %8s %14s %8s\n", "workers", "chain sort ms", "speedup",
+           "fork-join ms", "speedup");
+    for (int i = 0; i < nsweep; i++) {
+        tpool_t *pool = tpool_new(workers[i]);
+        if (!pool) {
+            fprintf(stderr, "ERROR: Could not start %d workers\n", workers[i]);
+            return 1;
+        }
+        double s = chain_sort(pool);
+        double f = fork_join(pool);
+        tpool_free(pool);
+        if (s < 0 || f < 0) {
+            fprintf(stderr, "ERROR: Wrong result with %d workers\n",
+                    workers[i]);
+            ok = false;
+            continue;
+        }
+        if (i == 0) {
+            base_sort = s;
+            base_fork = f;
+        }
+        printf("%-8d %14.2f %8.2f %14.2f %8.2f\n", workers[i], 1e3 * s,
+               base_sort / s, 1e3 * f, base_fork / f);
+    }
+
+    for (int i = 0; i < NQUEUES; i++)
+        q_free(queues[i]);
+    return ok ? 0 : 1;
+}
@@ -15,6 +15,10 @@
 #include "report.h"
 #include "web.h"
 
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+
 /* Some global values */
 int simulation = 0;
 int show_entropy = 0;
@@ -29,6 +33,20 @@ static bool block_timing = false;
 /* Time of day */
 static double first_time, last_time;
 
+/* Show the harness allocations of every command, and a summary at quit */
+static int memstats = 0;
+
+/* Harness allocations of the last command run, with live and peak bytes
+ * measured during it
+ */
+static alloc_counters_t last_mem;
+
+/* Time budget of every command in milliseconds, 0 for none, and whether a
+ * command running over it fails
+ */
+static int budget_ms = 0;
+static int budget_fail = 0;
+
 /* Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
  */
@@ -71,6 +89,7 @@ static bool push_file(char *fname);
 static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
+static bool do_time(int argc, char *argv[]);
 
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
@@ -87,12 +106,25 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->operation = operation;
     cmd->summary = summary;
     cmd->param = param;
+    cmd->runs = cmd->allocs = cmd->frees = cmd->bytes = cmd->peak = 0;
+    cmd->ms = cmd->max_ms = 0;
+    cmd->over_budget = 0;
     cmd->next = next_cmd;
     *last_loc = cmd;
 }
 
 /* Add a new parameter */
 void add_param(char *name, int *valp, char *summary, setter_func_t setter)
+{
+    add_param_named(name, valp, summary, NULL, setter);
+}
+
+/* Add a new parameter whose values can also be given by name */
+void add_param_named(char *name,
+                     int *valp,
+                     char *summary,
+                     const char *const *vnames,
+                     setter_func_t setter)
 {
     param_element_t *next_param = param_list;
     param_element_t **last_loc = &param_list;
@@ -106,6 +138,7 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->name = name;
     param->valp = valp;
     param->summary = summary;
+    param->vnames = vnames;
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
@@ -167,6 +200,57 @@ static void record_error()
     }
 }
 
+/* Charge the harness allocations made since before to a command */
+static void account_cmd(cmd_element_t *c, const alloc_counters_t *before)
+{
+    alloc_counters_t now = alloc_counters();
+    last_mem.allocs = now.allocs - before->allocs;
+    last_mem.frees = now.frees - before->frees;
+    last_mem.bytes = now.bytes - before->bytes;
+    last_mem.live = now.live;
+    last_mem.peak = now.peak;
+
+    c->runs++;
+    c->allocs += last_mem.allocs;
+    c->frees += last_mem.frees;
+    c->bytes += last_mem.bytes;
+    if (last_mem.peak > c->peak)
+        c->peak = last_mem.peak;
+}
+
+static void show_last_mem()
+{
+    report(1,
+           "Memory: %zu allocs, %zu frees, %zu bytes allocated, %zu bytes "
+           "live (peak %zu)",
+           last_mem.allocs, last_mem.frees, last_mem.bytes, last_mem.live,
+           last_mem.peak);
+}
+
+/* Charge the time of a run to a command, and check it against the budget.
+ * Return false if the run has to fail for going over it.
+ */
+static bool account_time(cmd_element_t *c, double seconds)
+{
+    double ms = 1e3 * seconds;
+    bool over = budget_ms > 0 && ms > budget_ms;
+    c->ms += ms;
+    if (ms > c->max_ms)
+        c->max_ms = ms;
+    if (over)
+        c->over_budget++;
+
+    if (budget_ms > 0)
+        report(1, "Time: %.3f ms of %d ms budget%s", ms, budget_ms,
+               over ? ", over budget" : "");
+    if (over && budget_fail) {
+        report(1, "ERROR: %s took %.3f ms, over its budget of %d ms", c->name,
+               ms, budget_ms);
+        return false;
+    }
+    return true;
+}
+
 /* Execute a command that has already been split into arguments */
 static bool interpret_cmda(int argc, char *argv[])
 {
@@ -178,7 +262,24 @@ static bool interpret_cmda(int argc, char *argv[])
     while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
         next_cmd = next_cmd->next;
     if (next_cmd) {
+        /* time accounts for the command it runs */
+        bool account = next_cmd->operation != do_time;
+        alloc_counters_t before = {0};
+        double start = 0;
+        if (account) {
+            alloc_peak_reset();
+            before = alloc_counters();
+            init_time(&start);
+        }
         ok = next_cmd->operation(argc, argv);
+        /* quit has released the commands */
+        if (account && !quit_flag) {
+            double seconds = delta_time(&start);
+            account_cmd(next_cmd, &before);
+            if (memstats)
+                show_last_mem();
+            ok = account_time(next_cmd, seconds) && ok;
+        }
         if (!ok)
             record_error();
     } else {
@@ -225,10 +326,41 @@ void set_echo(bool on)
 }
 
 /* Built-in commands */
+/* Show the harness allocations of every command run so far */
+static void show_cmd_mem()
+{
+    report(1, "Memory per command:");
+    report(1, "  %-12s %8s %10s %10s %12s %12s", "command", "runs", "allocs",
+           "frees", "bytes", "peak live");
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        if (c->runs)
+            report(1, "  %-12s %8zu %10zu %10zu %12zu %12zu", c->name, c->runs,
+                   c->allocs, c->frees, c->bytes, c->peak);
+    }
+}
+
+/* Show the time taken by every command run so far against the budget */
+static void show_cmd_time()
+{
+    report(1, "Time per command, budget %d ms:", budget_ms);
+    report(1, "  %-12s %8s %12s %12s %12s %8s", "command", "runs", "total ms",
+           "mean ms", "max ms", "over");
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        if (c->runs)
+            report(1, "  %-12s %8zu %12.3f %12.3f %12.3f %8zu", c->name,
+                   c->runs, c->ms, c->ms / c->runs, c->max_ms,
+                   c->over_budget);
+    }
+}
+
 static bool do_quit(int argc, char *argv[])
 {
     cmd_element_t *c = cmd_list;
     bool ok = true;
+    if (memstats)
+        show_cmd_mem();
+    if (budget_ms > 0)
+        show_cmd_time();
     while (c) {
         cmd_element_t *ele = c;
         c = c->next;
@@ -249,10 +381,46 @@ static bool do_quit(int argc, char *argv[])
         ok = ok && quit_helpers[i](argc, argv);
     }
 
+    if (memstats) {
+        alloc_counters_t mem = alloc_counters();
+        report(1,
+               "Memory in all: %zu allocs, %zu frees, %zu bytes allocated, "
+               "%zu bytes live",
+               mem.allocs, mem.frees, mem.bytes, mem.live);
+    }
+
     quit_flag = true;
     return ok;
 }
 
+/* Name of the current value of a parameter, NULL if it has none */
+static const char *param_vname(const param_element_t *p)
+{
+    if (!p->vnames || *p->valp < 0)
+        return NULL;
+    for (int i = 0; p->vnames[i]; i++) {
+        if (i == *p->valp)
+            return p->vnames[i];
+    }
+    return NULL;
+}
+
+static void show_params()
+{
+    param_element_t *plist = param_list;
+    report(1, "Options:");
+    while (plist) {
+        const char *vname = param_vname(plist);
+        if (vname)
+            report(1, "  %-12s%-12s | %s", plist->name, vname,
+                   plist->summary);
+        else
+            report(1, "  %-12s%-12d | %s", plist->name, *plist->valp,
+                   plist->summary);
+        plist = plist->next;
+    }
+}
+
 static bool do_help(int argc, char *argv[])
 {
     cmd_element_t *clist = cmd_list;
@@ -262,13 +430,7 @@ static bool do_help(int argc, char *argv[])
                clist->summary);
         clist = clist->next;
     }
-    param_element_t *plist = param_list;
-    report(1, "Options:");
-    while (plist) {
-        report(1, "  %-12s%-12d | %s", plist->name, *plist->valp,
-               plist->summary);
-        plist = plist->next;
-    }
+    show_params();
     return true;
 }
 
@@ -298,48 +460,65 @@ bool get_int(char *vname, int *loc)
     return true;
 }
 
+/* Parse the value of a parameter, either as integer or by its name */
+static bool get_param_value(const param_element_t *p, char *vname, int *loc)
+{
+    if (get_int(vname, loc))
+        return true;
+    for (int i = 0; p->vnames && p->vnames[i]; i++) {
+        if (strcmp(p->vnames[i], vname) == 0) {
+            *loc = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Report a value that is neither an integer nor a name of the parameter */
+static void report_bad_value(const param_element_t *p, const char *vname)
+{
+    if (!p->vnames) {
+        report(1, "Cannot parse '%s' as integer", vname);
+        return;
+    }
+    report_noreturn(1, "Cannot parse '%s' as integer or one of:", vname);
+    for (int i = 0; p->vnames[i]; i++)
+        report_noreturn(1, " %s", p->vnames[i]);
+    report(1, "");
+}
+
 static bool do_option(int argc, char *argv[])
 {
     if (argc == 1) {
-        param_element_t *plist = param_list;
-        report(1, "Options:");
-        while (plist) {
-            report(1, "  %-12s%-12d | %s", plist->name, *plist->valp,
-                   plist->summary);
-            plist = plist->next;
-        }
+        show_params();
         return true;
     }
 
     for (int i = 1; i < argc; i++) {
         char *name = argv[i];
         int value = 0;
-        bool found = false;
+        /* Find parameter in list */
+        param_element_t *plist = param_list;
+        while (plist && strcmp(plist->name, name) != 0)
+            plist = plist->next;
         /* Get value from next argument */
         if (i + 1 >= argc) {
             report(1, "No value given for parameter %s", name);
             return false;
-        } else if (!get_int(argv[++i], &value)) {
-            report(1, "Cannot parse '%s' as integer", argv[i]);
-            return false;
-        }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
         }
         /* Didn't find parameter */
-        if (!found) {
+        if (!plist) {
             report(1, "Unknown parameter '%s'", name);
             return false;
         }
+        if (!get_param_value(plist, argv[++i], &value)) {
+            report_bad_value(plist, argv[i]);
+            return false;
+        }
+        int oldval = *plist->valp;
+        *plist->valp = value;
+        if (plist->setter)
+            plist->setter(oldval);
     }
 
     return true;
@@ -388,6 +567,9 @@ static bool do_time(int argc, char *argv[])
         } else {
             delta = delta_time(&last_time);
             report(1, "Delta time = %.3f", delta);
+            /* With memstats on, the command has shown it already */
+            if (!memstats)
+                show_last_mem();
         }
     }
 
@@ -418,6 +600,14 @@ static bool do_web(int argc, char *argv[])
     return true;
 }
 
+static void budget_changed(int oldval)
+{
+    if (budget_ms < 0) {
+        report(1, "ERROR: Time budget cannot be negative");
+        budget_ms = oldval;
+    }
+}
+
 /* Initialize interpreter */
 void init_cmd()
 {
@@ -441,6 +631,14 @@ void init_cmd()
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
+    add_param("memstats", &memstats,
+              "Show the memory used by every command, and in all at quit",
+              NULL);
+    add_param("budget_ms", &budget_ms,
+              "Time budget of every command in milliseconds, 0 for none",
+              budget_changed);
+    add_param("budget_fail", &budget_fail,
+              "Do/don't fail commands running over the time budget", NULL);
 
     init_in();
     init_time(&last_time);
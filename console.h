@@ -24,6 +24,13 @@ typedef struct __cmd_element {
     cmd_func_t operation;
     char *summary;
     char *param;
+    /* Harness allocations summed over the runs of the command */
+    size_t runs, allocs, frees, bytes, peak;
+    /* Milliseconds summed over the runs, the longest run and the runs over
+     * the time budget
+     */
+    double ms, max_ms;
+    size_t over_budget;
     struct __cmd_element *next;
 } cmd_element_t;
 
@@ -35,6 +42,8 @@ typedef struct __param_element {
     char *name;
     int *valp;
     char *summary;
+    /* Optional NULL-terminated names of the values 0, 1, 2, ... */
+    const char *const *vnames;
     /* Function that gets called whenever parameter changes */
     setter_func_t setter;
     struct __param_element *next;
@@ -50,6 +59,13 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *parameter);
 /* Add a new parameter */
 void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 
+/* Add a new parameter whose values can also be given by name */
+void add_param_named(char *name,
+                     int *valp,
+                     char *summary,
+                     const char *const *vnames,
+                     setter_func_t setter);
+
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
@@ -0,0 +1,497 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cqueue.h"
+
+/* Index of the head, which also terminates the lists built while sorting */
+#define CQ_HEAD 0
+
+/* Smallest pools worth allocating, and the heap size below which holes are
+ * left alone.
+ */
+#define CQ_MIN_NODES 64
+#define CQ_MIN_HEAP 4096
+
+/* A string or blob occupies [off, off + len) of the heap; an integer keeps
+ * the high and low halves of its key in off and len.
+ */
+typedef struct {
+    uint32_t prev, next;
+    uint32_t off, len;
+} cq_node_t;
+
+struct cqueue {
+    cq_node_t *node;
+    uint32_t cap;    /* nodes allocated, the head included */
+    uint32_t used;   /* nodes ever handed out, the head included */
+    uint32_t free;   /* recycled nodes linked through next, 0 for none */
+    uint32_t size;
+    q_type_t type;
+
+    char *heap;
+    size_t heap_len, heap_cap;
+    size_t holes; /* bytes of heap_len no longer referenced */
+};
+
+static inline uint64_t key_of(const cq_node_t *n)
+{
+    return (uint64_t) n->off << 32 | n->len;
+}
+
+static inline uint32_t payload_len(const cqueue_t *cq, const cq_node_t *n)
+{
+    return cq->type == Q_INT ? 0 : n->len;
+}
+
+/* Same order as q_element_cmp() */
+static int cmp(const cqueue_t *cq, uint32_t a, uint32_t b)
+{
+    const cq_node_t *x = &cq->node[a], *y = &cq->node[b];
+    if (cq->type == Q_INT) {
+        uint64_t kx = key_of(x), ky = key_of(y);
+        return (kx > ky) - (kx < ky);
+    }
+    uint32_t n = x->len < y->len ? x->len : y->len;
+    int r = memcmp(cq->heap + x->off, cq->heap + y->off, n);
+    if (r)
+        return r;
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+cqueue_t *cq_new(q_type_t type)
+{
+    cqueue_t *cq = malloc(sizeof(cqueue_t));
+    if (!cq)
+        return NULL;
+    cq->node = malloc(CQ_MIN_NODES * sizeof(cq_node_t));
+    if (!cq->node) {
+        free(cq);
+        return NULL;
+    }
+    cq->cap = CQ_MIN_NODES;
+    cq->used = 1;
+    cq->free = 0;
+    cq->size = 0;
+    cq->type = type;
+    cq->node[CQ_HEAD].prev = cq->node[CQ_HEAD].next = CQ_HEAD;
+    cq->heap = NULL;
+    cq->heap_len = cq->heap_cap = cq->holes = 0;
+    return cq;
+}
+
+void cq_free(cqueue_t *cq)
+{
+    if (!cq)
+        return;
+    free(cq->node);
+    free(cq->heap);
+    free(cq);
+}
+
+size_t cq_size(const cqueue_t *cq)
+{
+    return cq->size;
+}
+
+size_t cq_bytes(const cqueue_t *cq)
+{
+    return sizeof(cqueue_t) + (size_t) cq->cap * sizeof(cq_node_t) +
+           cq->heap_cap;
+}
+
+/* Hand out a node, growing the pool by doubling when it is exhausted */
+static uint32_t node_alloc(cqueue_t *cq)
+{
+    if (cq->free) {
+        uint32_t i = cq->free;
+        cq->free = cq->node[i].next;
+        return i;
+    }
+    if (cq->used == cq->cap) {
+        if (cq->cap == UINT32_MAX)
+            return 0;
+        uint32_t cap = cq->cap > UINT32_MAX / 2 ? UINT32_MAX : 2 * cq->cap;
+        cq_node_t *node = malloc((size_t) cap * sizeof(cq_node_t));
+        if (!node)
+            return 0;
+        memcpy(node, cq->node, (size_t) cq->used * sizeof(cq_node_t));
+        free(cq->node);
+        cq->node = node;
+        cq->cap = cap;
+    }
+    return cq->used++;
+}
+
+/* Move the live payloads into a new heap of cap bytes, in list order */
+static bool heap_repack(cqueue_t *cq, size_t cap)
+{
+    char *heap = malloc(cap);
+    if (!heap)
+        return false;
+    size_t len = 0;
+    for (uint32_t i = cq->node[CQ_HEAD].next; i != CQ_HEAD;
+         i = cq->node[i].next) {
+        cq_node_t *n = &cq->node[i];
+        memcpy(heap + len, cq->heap + n->off, n->len);
+        n->off = len;
+        len += n->len;
+    }
+    free(cq->heap);
+    cq->heap = heap;
+    cq->heap_len = len;
+    cq->heap_cap = cap;
+    cq->holes = 0;
+    return true;
+}
+
+/* Make room for need more bytes at the end of the heap */
+static bool heap_reserve(cqueue_t *cq, size_t need)
+{
+    if (cq->heap_len + need <= cq->heap_cap)
+        return true;
+    size_t live = cq->heap_len - cq->holes;
+    if (need > (size_t) UINT32_MAX - live)
+        return false;
+    size_t cap = 2 * (live + need);
+    if (cap < CQ_MIN_HEAP)
+        cap = CQ_MIN_HEAP;
+    if (cap > UINT32_MAX)
+        cap = UINT32_MAX;
+    return heap_repack(cq, cap);
+}
+
+/* Unlink node i, recycle it and account for the hole its payload leaves */
+static void node_release(cqueue_t *cq, uint32_t i)
+{
+    cq_node_t *n = &cq->node[i];
+    cq->node[n->prev].next = n->next;
+    cq->node[n->next].prev = n->prev;
+    cq->holes += payload_len(cq, n);
+    n->next = cq->free;
+    cq->free = i;
+    cq->size--;
+}
+
+/* Squeeze out the holes once they are the larger part of the heap.  It is
+ * only an optimization, so a failed allocation keeps the old heap.
+ */
+static void heap_trim(cqueue_t *cq)
+{
+    if (cq->heap_len >= CQ_MIN_HEAP && 2 * cq->holes > cq->heap_len) {
+        size_t live = cq->heap_len - cq->holes;
+        heap_repack(cq, live + live / 2 > CQ_MIN_HEAP ? live + live / 2
+                                                      : CQ_MIN_HEAP);
+    }
+}
+
+static void link_after(cqueue_t *cq, uint32_t i, uint32_t prev)
+{
+    uint32_t next = cq->node[prev].next;
+    cq->node[i].prev = prev;
+    cq->node[i].next = next;
+    cq->node[prev].next = i;
+    cq->node[next].prev = i;
+}
+
+static bool insert(cqueue_t *cq, const element_t *e, bool tail)
+{
+    if (!cq || !e || e->type != cq->type || cq->size == UINT32_MAX - 1)
+        return false;
+    if (cq->type != Q_INT && !heap_reserve(cq, e->len))
+        return false;
+    uint32_t i = node_alloc(cq);
+    if (!i)
+        return false;
+
+    cq_node_t *n = &cq->node[i];
+    if (cq->type == Q_INT) {
+        n->off = e->prefix >> 32;
+        n->len = (uint32_t) e->prefix;
+    } else {
+        n->off = cq->heap_len;
+        n->len = e->len;
+        memcpy(cq->heap + cq->heap_len, e->value, e->len);
+        cq->heap_len += e->len;
+    }
+    link_after(cq, i, tail ? cq->node[CQ_HEAD].prev : CQ_HEAD);
+    cq->size++;
+    return true;
+}
+
+bool cq_insert_head(cqueue_t *cq, const element_t *e)
+{
+    return insert(cq, e, false);
+}
+
+bool cq_insert_tail(cqueue_t *cq, const element_t *e)
+{
+    return insert(cq, e, true);
+}
+
+/* Fill in e as a probe of node i, copying the payload into buf */
+static void copy_out(const cqueue_t *cq,
+                     uint32_t i,
+                     element_t *e,
+                     char *buf,
+                     size_t bufsize)
+{
+    const cq_node_t *n = &cq->node[i];
+    if (cq->type == Q_INT) {
+        if (e) {
+            e->value = NULL;
+            e->prefix = key_of(n);
+            e->len = 0;
+            e->type = Q_INT;
+        }
+        if (buf && bufsize) {
+            element_t tmp = {.prefix = key_of(n)};
+            snprintf(buf, bufsize, "%" PRId64, q_element_int(&tmp));
+        }
+        return;
+    }
+    if (!buf || !bufsize)
+        return;
+    size_t len = n->len < bufsize - 1 ? n->len : bufsize - 1;
+    memcpy(buf, cq->heap + n->off, len);
+    buf[len] = '\0';
+    if (e) {
+        e->value = buf;
+        e->type = cq->type;
+        q_element_setkey(e, len);
+    }
+}
+
+static bool remove_at(cqueue_t *cq,
+                      uint32_t i,
+                      element_t *e,
+                      char *buf,
+                      size_t bufsize)
+{
+    if (!cq || !cq->size)
+        return false;
+    copy_out(cq, i, e, buf, bufsize);
+    node_release(cq, i);
+    heap_trim(cq);
+    return true;
+}
+
+bool cq_remove_head(cqueue_t *cq, element_t *e, char *buf, size_t bufsize)
+{
+    return cq && remove_at(cq, cq->node[CQ_HEAD].next, e, buf, bufsize);
+}
+
+bool cq_remove_tail(cqueue_t *cq, element_t *e, char *buf, size_t bufsize)
+{
+    return cq && remove_at(cq, cq->node[CQ_HEAD].prev, e, buf, bufsize);
+}
+
+cqueue_t *cq_from_queue(struct list_head *head, q_type_t type)
+{
+    if (!head)
+        return NULL;
+    cqueue_t *cq = cq_new(type);
+    if (!cq)
+        return NULL;
+    element_t *e;
+    list_for_each_entry (e, head, list) {
+        if (!cq_insert_tail(cq, e)) {
+            cq_free(cq);
+            return NULL;
+        }
+    }
+    return cq;
+}
+
+bool cq_to_queue(cqueue_t *cq, struct list_head *head)
+{
+    if (!cq || !head)
+        return false;
+    for (uint32_t i = cq->node[CQ_HEAD].next; i != CQ_HEAD;
+         i = cq->node[i].next) {
+        const cq_node_t *n = &cq->node[i];
+        element_t *e;
+        if (cq->type == Q_INT) {
+            element_t tmp = {.prefix = key_of(n)};
+            e = q_element_new_int(q_element_int(&tmp));
+        } else {
+            e = q_element_new(cq->type, cq->heap + n->off, n->len);
+        }
+        if (!e)
+            return false;
+        list_add_tail(&e->list, head);
+    }
+    return true;
+}
+
+bool cq_delete_mid(cqueue_t *cq)
+{
+    if (!cq || !cq->size)
+        return false;
+    uint32_t i = cq->node[CQ_HEAD].next;
+    for (uint32_t k = cq->size / 2; k > 0; k--)
+        i = cq->node[i].next;
+    node_release(cq, i);
+    heap_trim(cq);
+    return true;
+}
+
+void cq_delete_dup(cqueue_t *cq)
+{
+    if (!cq)
+        return;
+    uint32_t i = cq->node[CQ_HEAD].next;
+    while (i != CQ_HEAD) {
+        uint32_t next = cq->node[i].next;
+        bool dup = false;
+        while (next != CQ_HEAD && !cmp(cq, i, next)) {
+            uint32_t after = cq->node[next].next;
+            node_release(cq, next);
+            next = after;
+            dup = true;
+        }
+        if (dup)
+            node_release(cq, i);
+        i = next;
+    }
+    heap_trim(cq);
+}
+
+void cq_swap(cqueue_t *cq)
+{
+    cq_reverseK(cq, 2);
+}
+
+/* Turn the nodes from first to last around between prev and next */
+static void reverse_range(cqueue_t *cq,
+                          uint32_t prev,
+                          uint32_t first,
+                          uint32_t last,
+                          uint32_t next)
+{
+    uint32_t i = first;
+    while (true) {
+        cq_node_t *n = &cq->node[i];
+        uint32_t t = n->next;
+        n->next = n->prev;
+        n->prev = t;
+        if (i == last)
+            break;
+        i = t;
+    }
+    cq->node[prev].next = last;
+    cq->node[last].prev = prev;
+    cq->node[first].next = next;
+    cq->node[next].prev = first;
+}
+
+void cq_reverse(cqueue_t *cq)
+{
+    if (!cq || cq->size < 2)
+        return;
+    reverse_range(cq, CQ_HEAD, cq->node[CQ_HEAD].next,
+                  cq->node[CQ_HEAD].prev, CQ_HEAD);
+}
+
+void cq_reverseK(cqueue_t *cq, int k)
+{
+    if (!cq || k < 2)
+        return;
+    uint32_t prev = CQ_HEAD;
+    while (true) {
+        uint32_t first = cq->node[prev].next, last = first;
+        for (int n = 1; n < k && last != CQ_HEAD; n++)
+            last = cq->node[last].next;
+        if (first == CQ_HEAD || last == CQ_HEAD)
+            return;
+        reverse_range(cq, prev, first, last, cq->node[last].next);
+        prev = first;
+    }
+}
+
+/* Merge two sorted lists linked through next and ended by CQ_HEAD.  Ties
+ * take from a, which holds the earlier elements, so the sort is stable.
+ */
+static uint32_t merge(cqueue_t *cq, uint32_t a, uint32_t b, bool descend)
+{
+    uint32_t head = CQ_HEAD, *tail = &head;
+    while (a != CQ_HEAD && b != CQ_HEAD) {
+        int c = cmp(cq, a, b);
+        if (descend ? c >= 0 : c <= 0) {
+            *tail = a;
+            tail = &cq->node[a].next;
+            a = *tail;
+        } else {
+            *tail = b;
+            tail = &cq->node[b].next;
+            b = *tail;
+        }
+    }
+    *tail = a != CQ_HEAD ? a : b;
+    return head;
+}
+
+/* Bottom-up merge sort: run[i] holds a sorted run of 2^i nodes, and every
+ * node is carried into the runs like an increment of a binary counter.
+ */
+void cq_sort(cqueue_t *cq, bool descend)
+{
+    if (!cq || cq->size < 2)
+        return;
+    uint32_t run[33] = {0};
+    uint32_t i = cq->node[CQ_HEAD].next;
+    while (i != CQ_HEAD) {
+        uint32_t carry = i;
+        i = cq->node[i].next;
+        cq->node[carry].next = CQ_HEAD;
+        int r = 0;
+        for (; run[r] != CQ_HEAD; r++) {
+            carry = merge(cq, run[r], carry, descend);
+            run[r] = CQ_HEAD;
+        }
+        run[r] = carry;
+    }
+    uint32_t sorted = CQ_HEAD;
+    for (int r = 0; r < 33; r++) {
+        if (run[r] != CQ_HEAD)
+            sorted = sorted == CQ_HEAD ? run[r]
+                                       : merge(cq, run[r], sorted, descend);
+    }
+
+    uint32_t prev = CQ_HEAD;
+    cq->node[CQ_HEAD].next = sorted;
+    for (i = sorted; i != CQ_HEAD; prev = i, i = cq->node[i].next)
+        cq->node[i].prev = prev;
+    cq->node[CQ_HEAD].prev = prev;
+}
+
+/* Walk from the tail keeping the nodes no element to their right beats */
+static size_t keep_monotonic(cqueue_t *cq, bool ascend)
+{
+    if (!cq)
+        return 0;
+    uint32_t best = cq->node[CQ_HEAD].prev;
+    uint32_t i = best == CQ_HEAD ? CQ_HEAD : cq->node[best].prev;
+    while (i != CQ_HEAD) {
+        uint32_t prev = cq->node[i].prev;
+        int c = cmp(cq, i, best);
+        if (ascend ? c > 0 : c < 0)
+            node_release(cq, i);
+        else
+            best = i;
+        i = prev;
+    }
+    heap_trim(cq);
+    return cq->size;
+}
+
+size_t cq_ascend(cqueue_t *cq)
+{
+    return keep_monotonic(cq, true);
+}
+
+size_t cq_descend(cqueue_t *cq)
+{
+    return keep_monotonic(cq, false);
+}
@@ -0,0 +1,181 @@
+#ifndef LAB0_CQUEUE_H
+#define LAB0_CQUEUE_H
+
+/* Compact queue for very large queues.
+ *
+ * A cqueue keeps its nodes in one array and links them by 32-bit indices
+ * rather than pointers, and keeps every string or blob in one byte heap,
+ * addressed by a 32-bit offset and length.  A node is 16 bytes with no
+ * allocation of its own, against an element_t and a value buffer for
+ * every element of a regular queue, each with its malloc and harness
+ * headers.  Integers are held in the node itself.
+ *
+ * Node 0 is the head, so index 0 also ends the lists used while sorting.
+ * Removed nodes are recycled through a free list, and removed payloads
+ * leave holes in the heap which are squeezed out, in list order, whenever
+ * the heap grows or more than half of it is holes.
+ *
+ * The operations follow the contracts documented in queue.h.  A cqueue
+ * holds at most UINT32_MAX - 1 elements and UINT32_MAX bytes of payload.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+#pragma GCC visibility push(default)
+
+typedef struct cqueue cqueue_t;
+
+/**
+ * cq_new() - Create an empty compact queue
+ * @type: type of every payload the queue will hold
+ *
+ * Return: the queue, NULL for allocation failed
+ */
+cqueue_t *cq_new(q_type_t type);
+
+/**
+ * cq_free() - Free a compact queue and every payload in it
+ * @cq: queue, may be NULL
+ */
+void cq_free(cqueue_t *cq);
+
+/**
+ * cq_from_queue() - Create a compact copy of a queue
+ * @head: header of queue, whose elements are all of type @type
+ * @type: type of the payloads
+ *
+ * Return: the copy, NULL for allocation failed or queue is NULL
+ */
+cqueue_t *cq_from_queue(struct list_head *head, q_type_t type);
+
+/**
+ * cq_to_queue() - Append a copy of every element of a compact queue
+ * @cq: queue
+ * @head: header of the queue to append to
+ *
+ * Return: true for success, false for allocation failed, in which case
+ * some of the copies may have been appended
+ */
+bool cq_to_queue(cqueue_t *cq, struct list_head *head);
+
+/**
+ * cq_insert_head() - Insert a copy of a payload at the head
+ * @cq: queue
+ * @e: element holding the payload, of the type of @cq; it may be a probe
+ *     whose @value is not reference counted
+ *
+ * Return: true for success, false for allocation failed or type mismatch
+ */
+bool cq_insert_head(cqueue_t *cq, const element_t *e);
+
+/**
+ * cq_insert_tail() - Insert a copy of a payload at the tail
+ * @cq: queue
+ * @e: element holding the payload, see cq_insert_head()
+ *
+ * Return: true for success, false for allocation failed or type mismatch
+ */
+bool cq_insert_tail(cqueue_t *cq, const element_t *e);
+
+/**
+ * cq_remove_head() - Remove the element at the head
+ * @cq: queue
+ * @e: filled in as a probe of the removed payload, may be NULL
+ * @buf: receives up to @bufsize - 1 bytes of the payload and a null byte;
+ *       @e->value points here, and @e->len counts the bytes copied
+ * @bufsize: size of @buf
+ *
+ * Return: true for success, false if the queue is empty
+ */
+bool cq_remove_head(cqueue_t *cq, element_t *e, char *buf, size_t bufsize);
+
+/**
+ * cq_remove_tail() - Remove the element at the tail
+ * @cq: queue
+ * @e: see cq_remove_head()
+ * @buf: see cq_remove_head()
+ * @bufsize: size of @buf
+ *
+ * Return: true for success, false if the queue is empty
+ */
+bool cq_remove_tail(cqueue_t *cq, element_t *e, char *buf, size_t bufsize);
+
+/**
+ * cq_size() - Number of elements of a compact queue
+ * @cq: queue
+ *
+ * Return: the number of elements
+ */
+size_t cq_size(const cqueue_t *cq);
+
+/**
+ * cq_bytes() - Memory held by a compact queue
+ * @cq: queue
+ *
+ * Return: bytes allocated for the nodes, the heap and the queue itself
+ */
+size_t cq_bytes(const cqueue_t *cq);
+
+/**
+ * cq_delete_mid() - Same as q_delete_mid()
+ * @cq: queue
+ *
+ * Return: true for success, false if the queue is empty
+ */
+bool cq_delete_mid(cqueue_t *cq);
+
+/**
+ * cq_delete_dup() - Same as q_delete_dup()
+ * @cq: queue
+ */
+void cq_delete_dup(cqueue_t *cq);
+
+/**
+ * cq_swap() - Same as q_swap()
+ * @cq: queue
+ */
+void cq_swap(cqueue_t *cq);
+
+/**
+ * cq_reverse() - Same as q_reverse()
+ * @cq: queue
+ */
+void cq_reverse(cqueue_t *cq);
+
+/**
+ * cq_reverseK() - Same as q_reverseK(), a final group of fewer than @k
+ * elements is left as it is
+ * @cq: queue
+ * @k: group size
+ */
+void cq_reverseK(cqueue_t *cq, int k);
+
+/**
+ * cq_sort() - Same as q_sort(), stable and without allocating
+ * @cq: queue
+ * @descend: whether to sort in descending order
+ */
+void cq_sort(cqueue_t *cq, bool descend);
+
+/**
+ * cq_ascend() - Same as q_ascend()
+ * @cq: queue
+ *
+ * Return: the number of elements left
+ */
+size_t cq_ascend(cqueue_t *cq);
+
+/**
+ * cq_descend() - Same as q_descend()
+ * @cq: queue
+ *
+ * Return: the number of elements left
+ */
+size_t cq_descend(cqueue_t *cq);
+
+#pragma GCC visibility pop
+
+#endif /* LAB0_CQUEUE_H */
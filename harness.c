@@ -1,10 +1,17 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -18,6 +25,12 @@
 /* Value at start of every allocated block */
 #define MAGICHEADER 0xdeadbeef
 
+/* Value at start of a block from test_aligned_alloc instead */
+#define MAGICALIGNED 0xdeadbeaf
+
+/* Value at start of a block carved by test_alloc_packed instead */
+#define MAGICPACKED 0xdeadbead
+
 /* Value when deallocate block */
 #define MAGICFREE 0xffffffff
 
@@ -27,46 +40,495 @@
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Bytes filled at each end of a payload at POISON_EDGES, a cache line */
+#define POISON_EDGE_BYTES 64
+
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
+/* Header in front of every allocated block, four words long so that the
+ * payload is 16-byte aligned like malloc's
  */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
+    size_t index; /* Position in the live blocks of its shard, and shard */
     size_t payload_size;
+    union {
+        size_t site; /* Profiled site of a live block, 0 for none */
+        struct __block_element *next; /* Next cached block of its class */
+    };
     size_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Freed blocks whose payload has at most CACHE_MAX_PAYLOAD bytes can be
+ * kept on a free list per size class of CACHE_CLASS_BYTES, up to
+ * CACHE_MAX_BYTES per shard, and handed out again by test_malloc.  Payloads
+ * of these sizes are always allocated rounded up to their class, so that
+ * every block of a class fits every request of it.  A cached block keeps
+ * MAGICFREE in its header and footer, and both are checked again when it is
+ * reused.
+ */
+#define CACHE_CLASS_BYTES 16
+#define CACHE_MAX_PAYLOAD 1024
+#define CACHE_NR_CLASSES (CACHE_MAX_PAYLOAD / CACHE_CLASS_BYTES + 1)
+#define CACHE_MAX_BYTES (16 << 20)
+
+/* Live blocks are kept in tables, and every block records its index in
+ * one, so that checking or forgetting a block takes constant time however
+ * many blocks are allocated.  A forgotten block is replaced by the last one
+ * of its table.
+ *
+ * So that threads do not contend for one lock, the tables are split into
+ * NR_SHARDS shards, each with its own lock, its own counters and its own
+ * cache of freed blocks.  A thread allocates from the shard it is given on
+ * first use, and a block keeps its shard in the low bits of its index, so
+ * that any thread can free it.  Live bytes and their peak are counted
+ * across shards with atomics.
+ */
+#define SHARD_BITS 4
+#define NR_SHARDS (1 << SHARD_BITS)
+#define BLOCKS_MIN_CAP 1024
+
+typedef struct {
+    pthread_mutex_t lock;
+    block_element_t **blocks;
+    size_t cap, count;
+    size_t allocs, frees, bytes;
+    block_element_t *cache[CACHE_NR_CLASSES];
+    alloc_cache_stats_t cache_stats;
+} __attribute__((aligned(64))) shard_t;
+
+static shard_t shards[NR_SHARDS] = {
+    [0 ... NR_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+static atomic_uint next_shard;
+static _Thread_local shard_t *thread_shard = NULL;
+
+static atomic_size_t live_bytes, peak_bytes;
+
+/* Blocks allocated in packed mode are carved in order out of chunks of
+ * PACK_CHUNK_BYTES, each block preceded by a pointer to its chunk, padded
+ * so that the payload keeps its alignment.  A chunk is freed once it is no
+ * longer carved and its last block is freed.  Blocks too large to share a
+ * chunk come from malloc as usual.
+ */
+#define PACK_CHUNK_BYTES (64 << 10)
+#define PACK_PREFIX 16
+
+typedef struct {
+    atomic_size_t refcnt; /* Live blocks, plus one while being carved */
+    size_t used;
+    alignas(16) unsigned char data[];
+} pack_chunk_t;
+
+static _Thread_local bool alloc_packed = false;
+static _Thread_local pack_chunk_t *pack_chunk = NULL;
+static atomic_bool cache_enabled;
+
+/* While profiling is on, allocations are counted per call site, the return
+ * address of the call to test_malloc, test_calloc or test_strdup.  Sites
+ * are kept in an open-addressing table, and a profiled block records its
+ * slot plus one, so that its free is charged to its site even once
+ * profiling is off.  Sites which do not fit share the last slot, whose
+ * caller is NULL.  The table is protected by sites_lock.
+ */
+#define SITES_CAP 512
+
+static atomic_bool profile_enabled;
+static alloc_site_t sites[SITES_CAP];
+static pthread_mutex_t sites_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
-static bool cautious_mode = true;
-static bool noallocate_mode = false;
-static bool error_occurred = false;
-static char *error_message = "";
+/* How much of every payload is filled with FILLCHAR */
+int poison_level = POISON_FULL;
 
-static int time_limit = 1;
+/* Modes, errors and exceptions belong to the thread running the command */
+static _Thread_local bool cautious_mode = true;
+static _Thread_local bool noallocate_mode = false;
+static _Thread_local bool error_occurred = false;
+static _Thread_local char *error_message = "";
+static _Thread_local bool worker_mode = false;
+
+/* Time limit of exception_setup(true), in milliseconds */
+int time_limit_ms = 1000;
 
 /* Data for managing exceptions */
-static jmp_buf env;
-static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+static _Thread_local jmp_buf env;
+static _Thread_local volatile sig_atomic_t jmp_ready = false;
+static _Thread_local bool time_limited = false;
+
+/* An exception raised while the thread is inside a function of the
+ * harness which allocates, frees or takes a lock, such as an expired time
+ * limit, waits for it to return: jumping out would leave a lock held or
+ * the blocks and counters inconsistent.  Each such function is a single
+ * critical section, from its entry to its return.
+ */
+static _Thread_local volatile sig_atomic_t critical_depth = 0;
+static _Thread_local volatile sig_atomic_t exception_deferred = false;
 
 /* Internal functions */
 
+#ifdef SIGEV_THREAD_ID
+/* Every thread arms a timer of its own, which signals only that thread, so
+ * that commands running in parallel each have their time limit.  The timer
+ * is deleted when its thread exits.
+ */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static pthread_key_t timer_key;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static _Thread_local timer_t *thread_timer = NULL;
+static _Thread_local sigset_t timer_oldmask;
+
+static void timer_destroy(void *t)
+{
+    timer_delete(*(timer_t *) t);
+    free(t);
+}
+
+static void timer_key_init()
+{
+    pthread_key_create(&timer_key, timer_destroy);
+}
+
+/* Start the time limit of the calling thread.
+ * Return false if it could not be.
+ */
+static bool arm_time_limit()
+{
+    if (!thread_timer) {
+        timer_t *t = malloc(sizeof(*t));
+        struct sigevent sev = {
+            .sigev_notify = SIGEV_THREAD_ID,
+            .sigev_signo = SIGALRM,
+        };
+        sev.sigev_notify_thread_id = syscall(SYS_gettid);
+        if (!t || timer_create(CLOCK_MONOTONIC, &sev, t)) {
+            free(t);
+            return false;
+        }
+        pthread_once(&timer_once, timer_key_init);
+        pthread_setspecific(timer_key, t);
+        thread_timer = t;
+    }
+
+    /* Workers of thread pools start with every signal blocked */
+    sigset_t alrm;
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
+    pthread_sigmask(SIG_UNBLOCK, &alrm, &timer_oldmask);
+
+    struct itimerspec its = {
+        .it_value.tv_sec = time_limit_ms / 1000,
+        .it_value.tv_nsec = time_limit_ms % 1000 * 1000000L,
+    };
+    timer_settime(*thread_timer, 0, &its, NULL);
+    return true;
+}
+
+/* Stop the time limit of the calling thread, and restore its signal mask
+ * unless siglongjmp() has already done so
+ */
+static void disarm_time_limit(bool restore_mask)
+{
+    struct itimerspec its = {0};
+    timer_settime(*thread_timer, 0, &its, NULL);
+    if (restore_mask)
+        pthread_sigmask(SIG_SETMASK, &timer_oldmask, NULL);
+}
+#else
+/* The interval timer is process wide, so only threads other than workers
+ * use it
+ */
+static bool arm_time_limit()
+{
+    if (worker_mode)
+        return false;
+    struct itimerval its = {
+        .it_value.tv_sec = time_limit_ms / 1000,
+        .it_value.tv_usec = time_limit_ms % 1000 * 1000L,
+    };
+    setitimer(ITIMER_REAL, &its, NULL);
+    return true;
+}
+
+static void disarm_time_limit(bool restore_mask)
+{
+    struct itimerval its = {0};
+    setitimer(ITIMER_REAL, &its, NULL);
+}
+#endif
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
+    if (fail_probability <= 0)
+        return false;
     double weight = (double) random() / RAND_MAX;
     return (weight < 0.01 * fail_probability);
 }
 
+/* Fill a payload with FILLCHAR, all of it or only its ends */
+static void poison(unsigned char *p, size_t size)
+{
+    if (poison_level == POISON_NONE)
+        return;
+    if (poison_level == POISON_FULL || size <= 2 * POISON_EDGE_BYTES) {
+        memset(p, FILLCHAR, size);
+        return;
+    }
+    memset(p, FILLCHAR, POISON_EDGE_BYTES);
+    memset(p + size - POISON_EDGE_BYTES, FILLCHAR, POISON_EDGE_BYTES);
+}
+
+static void critical_enter()
+{
+    critical_depth++;
+}
+
+static void critical_exit()
+{
+    if (--critical_depth == 0 && exception_deferred) {
+        exception_deferred = false;
+        trigger_exception(error_message);
+    }
+}
+
+static shard_t *my_shard()
+{
+    if (!thread_shard)
+        thread_shard = &shards[atomic_fetch_add(&next_shard, 1) % NR_SHARDS];
+    return thread_shard;
+}
+
+/* Shard of a block; the bits read never change while the block is live */
+static shard_t *block_shard(const block_element_t *b)
+{
+    return &shards[b->index & (NR_SHARDS - 1)];
+}
+
+static bool blocks_resize(shard_t *sh, size_t cap)
+{
+    block_element_t **t = realloc(sh->blocks, cap * sizeof(*t));
+    if (!t)
+        return false;
+    sh->blocks = t;
+    sh->cap = cap;
+    return true;
+}
+
+static bool blocks_insert(shard_t *sh, block_element_t *b)
+{
+    if (sh->count == sh->cap &&
+        !blocks_resize(sh, sh->cap ? 2 * sh->cap : BLOCKS_MIN_CAP))
+        return false;
+    b->index = sh->count << SHARD_BITS | (size_t) (sh - shards);
+    sh->blocks[sh->count++] = b;
+    sh->allocs++;
+    sh->bytes += b->payload_size;
+    return true;
+}
+
+/* Is b a live block of its shard?  Its index is only trusted once the
+ * table agrees
+ */
+static bool blocks_contain(const shard_t *sh, const block_element_t *b)
+{
+    size_t i = b->index >> SHARD_BITS;
+    return i < sh->count && sh->blocks[i] == b;
+}
+
+static void blocks_remove(shard_t *sh, block_element_t *b)
+{
+    block_element_t *last = sh->blocks[--sh->count];
+    sh->blocks[b->index >> SHARD_BITS] = last;
+    last->index = b->index;
+    sh->frees++;
+
+    /* Failing to shrink only leaves the table larger than needed */
+    if (sh->cap > BLOCKS_MIN_CAP && 4 * sh->count < sh->cap)
+        blocks_resize(sh, sh->cap / 2);
+}
+
+static void count_live(size_t size)
+{
+    size_t live = atomic_fetch_add_explicit(&live_bytes, size,
+                                            memory_order_relaxed) +
+                  size;
+    size_t peak = atomic_load_explicit(&peak_bytes, memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&peak_bytes, &peak, live,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+/* Given pointer to block, find its footer */
+static size_t *find_footer(block_element_t *b)
+{
+    // cppcheck-suppress nullPointerRedundantCheck
+    size_t *p =
+        (size_t *) ((size_t) b + b->payload_size + sizeof(block_element_t));
+    return p;
+}
+
+static size_t size_class(size_t size)
+{
+    return (size + CACHE_CLASS_BYTES - 1) / CACHE_CLASS_BYTES;
+}
+
+/* Bytes to allocate for a block with a payload of size bytes */
+static size_t block_bytes(size_t size)
+{
+    if (size <= CACHE_MAX_PAYLOAD)
+        size = size_class(size) * CACHE_CLASS_BYTES;
+    return size + sizeof(block_element_t) + sizeof(size_t);
+}
+
+/* Take a cached block of a shard fitting a payload of size bytes, NULL if
+ * none
+ */
+static block_element_t *cache_get(shard_t *sh, size_t size)
+{
+    if (!atomic_load_explicit(&cache_enabled, memory_order_relaxed))
+        return NULL;
+
+    block_element_t *b = NULL;
+    pthread_mutex_lock(&sh->lock);
+    if (size <= CACHE_MAX_PAYLOAD && (b = sh->cache[size_class(size)])) {
+        sh->cache[size_class(size)] = b->next;
+        sh->cache_stats.hits++;
+        sh->cache_stats.blocks--;
+        sh->cache_stats.bytes -= block_bytes(size);
+    } else {
+        sh->cache_stats.misses++;
+    }
+    pthread_mutex_unlock(&sh->lock);
+
+    if (b && (b->magic_header != MAGICFREE || *find_footer(b) != MAGICFREE)) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in freed block with address %p "
+                     "when reusing it",
+                     (void *) &b->payload);
+        error_occurred = true;
+    }
+    return b;
+}
+
+/* Keep a freed block for reuse, with the lock of its shard held.
+ * Return false if the caller has to free it.
+ */
+static bool cache_put(shard_t *sh, block_element_t *b)
+{
+    size_t bytes = block_bytes(b->payload_size);
+    if (!atomic_load_explicit(&cache_enabled, memory_order_relaxed) ||
+        b->payload_size > CACHE_MAX_PAYLOAD ||
+        sh->cache_stats.bytes + bytes > CACHE_MAX_BYTES)
+        return false;
+
+    size_t c = size_class(b->payload_size);
+    b->next = sh->cache[c];
+    sh->cache[c] = b;
+    sh->cache_stats.blocks++;
+    sh->cache_stats.bytes += bytes;
+    return true;
+}
+
+static void pack_put(pack_chunk_t *c)
+{
+    if (atomic_fetch_sub(&c->refcnt, 1) == 1)
+        free(c);
+}
+
+/* Carve a block for a payload of size bytes out of the chunk of the
+ * thread.  Return NULL if it is too large or there is no memory for a
+ * chunk.
+ */
+static block_element_t *packed_block(size_t size)
+{
+    size_t bytes = (PACK_PREFIX + block_bytes(size) + 15) & ~(size_t) 15;
+    if (bytes > PACK_CHUNK_BYTES / 4)
+        return NULL;
+    if (!pack_chunk || pack_chunk->used + bytes > PACK_CHUNK_BYTES) {
+        pack_chunk_t *c = malloc(sizeof(pack_chunk_t) + PACK_CHUNK_BYTES);
+        if (!c)
+            return NULL;
+        atomic_init(&c->refcnt, 1);
+        c->used = 0;
+        if (pack_chunk)
+            pack_put(pack_chunk);
+        pack_chunk = c;
+    }
+
+    unsigned char *p = pack_chunk->data + pack_chunk->used;
+    pack_chunk->used += bytes;
+    atomic_fetch_add(&pack_chunk->refcnt, 1);
+    block_element_t *b = (block_element_t *) (p + PACK_PREFIX);
+    ((pack_chunk_t **) b)[-1] = pack_chunk;
+    return b;
+}
+
+/* Stop carving, letting the current chunk go with its last block */
+static void pack_end()
+{
+    alloc_packed = false;
+    if (pack_chunk) {
+        pack_put(pack_chunk);
+        pack_chunk = NULL;
+    }
+}
+
+/* Slot plus one of the site of caller, added if it is new */
+static size_t site_of(void *caller)
+{
+    size_t n = SITES_CAP - 1, s = ((uintptr_t) caller >> 2) % n;
+    for (size_t i = 0; i < n; i++, s = (s + 1) % n) {
+        if (!sites[s].caller)
+            sites[s].caller = caller;
+        if (sites[s].caller == caller)
+            return s + 1;
+    }
+    return SITES_CAP;
+}
+
+/* Charge a new block to its site */
+static void profile_alloc(block_element_t *b, void *caller)
+{
+    b->site = 0;
+    if (!atomic_load_explicit(&profile_enabled, memory_order_relaxed))
+        return;
+
+    pthread_mutex_lock(&sites_lock);
+    b->site = site_of(caller);
+    alloc_site_t *st = &sites[b->site - 1];
+    size_t size = b->payload_size;
+    st->allocs++;
+    st->bytes += size;
+    st->live += size;
+    if (st->live > st->peak)
+        st->peak = st->live;
+
+    int k = 0;
+    while (k < ALLOC_SIZE_BUCKETS - 1 && size > (size_t) 16 << (2 * k))
+        k++;
+    st->sizes[k]++;
+    pthread_mutex_unlock(&sites_lock);
+}
+
+/* Charge the free of size bytes to a site */
+static void profile_free(size_t site, size_t size)
+{
+    pthread_mutex_lock(&sites_lock);
+    alloc_site_t *st = &sites[site - 1];
+    st->frees++;
+    st->live -= size;
+    pthread_mutex_unlock(&sites_lock);
+}
+
 /* Find header of block, given its payload.
  * Signal error if doesn't seem like legitimate block
  */
@@ -81,12 +543,10 @@ static block_element_t *find_header(void *p)
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
+        shard_t *sh = block_shard(b);
+        pthread_mutex_lock(&sh->lock);
+        bool found = blocks_contain(sh, b);
+        pthread_mutex_unlock(&sh->lock);
         if (!found) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
@@ -95,7 +555,8 @@ static block_element_t *find_header(void *p)
         }
     }
 
-    if (b->magic_header != MAGICHEADER) {
+    if (b->magic_header != MAGICHEADER && b->magic_header != MAGICALIGNED &&
+        b->magic_header != MAGICPACKED) {
         report_event(
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
@@ -106,56 +567,134 @@ static block_element_t *find_header(void *p)
     return b;
 }
 
-/* Given pointer to block, find its footer */
-static size_t *find_footer(block_element_t *b)
+/* Implementation of application functions */
+
+/* Release the block of payload p, inside a critical section */
+static void release_block(void *p)
 {
-    // cppcheck-suppress nullPointerRedundantCheck
-    size_t *p =
-        (size_t *) ((size_t) b + b->payload_size + sizeof(block_element_t));
-    return p;
+    block_element_t *b = find_header(p);
+    size_t footer = *find_footer(b);
+    if (footer != MAGICFOOTER) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in block with address %p when "
+                     "attempting to free it",
+                     p);
+        error_occurred = true;
+    }
+    bool aligned = b->magic_header == MAGICALIGNED;
+    bool packed = b->magic_header == MAGICPACKED;
+    b->magic_header = MAGICFREE;
+    *find_footer(b) = MAGICFREE;
+    poison(p, b->payload_size);
+
+    /* A block which is not live is neither freed again nor cached, and
+     * aligned and packed blocks are never cached
+     */
+    shard_t *sh = block_shard(b);
+    size_t size = b->payload_size, site = 0;
+    pthread_mutex_lock(&sh->lock);
+    bool live = blocks_contain(sh, b);
+    if (live) {
+        site = b->site;
+        blocks_remove(sh, b);
+    }
+    bool cached = live && !aligned && !packed && cache_put(sh, b);
+    pthread_mutex_unlock(&sh->lock);
+
+    if (!live)
+        return;
+    atomic_fetch_sub_explicit(&live_bytes, size, memory_order_relaxed);
+    if (site)
+        profile_free(site, size);
+    if (packed)
+        pack_put(((pack_chunk_t **) b)[-1]);
+    else if (!cached)
+        free((char *) b - (aligned ? ((size_t *) b)[-1] : 0));
 }
 
-/* Implementation of application functions */
+/* Allocate from the C library a block whose payload of size bytes is
+ * aligned to alignment, a power of two larger than the header.  The header
+ * is preceded by padding, whose last word holds the offset of the header
+ * from the start of the allocation.
+ */
+static block_element_t *aligned_block(size_t size, size_t alignment)
+{
+    size_t mask = alignment - 1, head = sizeof(block_element_t);
+    size_t offset = ((head + sizeof(size_t) + mask) & ~mask) - head;
+    size_t bytes = offset + head + size + sizeof(size_t);
+    char *raw = aligned_alloc(alignment, (bytes + mask) & ~mask);
+    if (!raw)
+        return NULL;
+    block_element_t *b = (block_element_t *) (raw + offset);
+    ((size_t *) b)[-1] = offset;
+    return b;
+}
 
-void *test_malloc(size_t size)
+/* Allocate a block for caller, the site it is charged to.  A non-zero
+ * alignment larger than the header asks for an aligned block.
+ */
+static void *alloc_block(size_t size, size_t alignment, void *caller)
 {
+    critical_enter();
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
+        critical_exit();
         return NULL;
     }
 
     if (fail_allocation()) {
         report_event(MSG_WARN, "Malloc returning NULL");
+        critical_exit();
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    shard_t *sh = my_shard();
+    block_element_t *new_block = NULL;
+    size_t magic = MAGICHEADER;
+    if (alignment) {
+        new_block = aligned_block(size, alignment);
+        magic = MAGICALIGNED;
+    } else if (alloc_packed && (new_block = packed_block(size))) {
+        magic = MAGICPACKED;
+    } else if (alloc_packed || !(new_block = cache_get(sh, size))) {
+        new_block = malloc(block_bytes(size));
+    }
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
+    new_block->magic_header = magic;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
-    memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    poison(p, size);
+    pthread_mutex_lock(&sh->lock);
+    bool added = blocks_insert(sh, new_block);
+    pthread_mutex_unlock(&sh->lock);
+    if (!added)
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+    count_live(size);
+    profile_alloc(new_block, caller);
 
+    /* An exception raised meanwhile unwinds the caller before it receives
+     * the block, so give the block back rather than leak it
+     */
+    if (critical_depth == 1 && exception_deferred) {
+        release_block(p);
+        p = NULL;
+    }
+    critical_exit();
     return p;
 }
 
+void *test_malloc(size_t size)
+{
+    return alloc_block(size, 0, __builtin_return_address(0));
+}
+
 // cppcheck-suppress unusedFunction
 void *test_calloc(size_t nelem, size_t elsize)
 {
@@ -163,66 +702,164 @@ void *test_calloc(size_t nelem, size_t elsize)
      * https://danluu.com/malloc-tutorial/
      */
     size_t size = nelem * elsize;  // TODO: check for overflow
-    void *ptr = test_malloc(size);
+    void *ptr = alloc_block(size, 0, __builtin_return_address(0));
     memset(ptr, 0, size);
     return ptr;
 }
 
 void test_free(void *p)
 {
-    if (noallocate_mode) {
+    critical_enter();
+    if (noallocate_mode)
         report_event(MSG_FATAL, "Calls to free disallowed");
-        return;
-    }
+    else if (p)
+        release_block(p);
+    critical_exit();
+}
 
-    if (!p)
-        return;
+void test_alloc_packed(bool packed)
+{
+    critical_enter();
+    if (packed)
+        alloc_packed = true;
+    else
+        pack_end();
+    critical_exit();
+}
 
-    block_element_t *b = find_header(p);
-    size_t footer = *find_footer(b);
-    if (footer != MAGICFOOTER) {
-        report_event(MSG_ERROR,
-                     "Corruption detected in block with address %p when "
-                     "attempting to free it",
-                     p);
+void *test_aligned_alloc(size_t alignment, size_t size)
+{
+    if (!alignment || (alignment & (alignment - 1))) {
+        report_event(MSG_ERROR, "Alignment %zu is not a power of two",
+                     alignment);
         error_occurred = true;
+        return NULL;
     }
-    b->magic_header = MAGICFREE;
-    *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
-
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
-
-    free(b);
-    allocated_count--;
+    /* Headers keep every payload aligned as malloc's already */
+    if (alignment <= sizeof(block_element_t))
+        alignment = 0;
+    return alloc_block(size, alignment, __builtin_return_address(0));
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = alloc_block(len, 0, __builtin_return_address(0));
     if (!new)
         return NULL;
 
     return memcpy(new, s, len);
 }
 
+alloc_counters_t alloc_counters()
+{
+    critical_enter();
+    alloc_counters_t c = {0};
+    for (int i = 0; i < NR_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        c.allocs += shards[i].allocs;
+        c.frees += shards[i].frees;
+        c.bytes += shards[i].bytes;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    c.live = atomic_load(&live_bytes);
+    c.peak = atomic_load(&peak_bytes);
+    critical_exit();
+    return c;
+}
+
+void alloc_peak_reset()
+{
+    atomic_store(&peak_bytes, atomic_load(&live_bytes));
+}
+
 size_t allocation_check()
 {
-    return allocated_count;
+    critical_enter();
+    size_t cnt = 0;
+    for (int i = 0; i < NR_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        cnt += shards[i].count;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    critical_exit();
+    return cnt;
 }
 
 /* Implementation of functions for testing */
 
+/* Turn the cache of freed blocks on or off.
+ * Turning it off hands every cached block back to malloc.
+ */
+void set_alloc_cache(bool enable)
+{
+    atomic_store(&cache_enabled, enable);
+    if (enable)
+        return;
+
+    critical_enter();
+    for (int i = 0; i < NR_SHARDS; i++) {
+        shard_t *sh = &shards[i];
+        block_element_t *lists[CACHE_NR_CLASSES];
+
+        pthread_mutex_lock(&sh->lock);
+        memcpy(lists, sh->cache, sizeof(lists));
+        memset(sh->cache, 0, sizeof(sh->cache));
+        sh->cache_stats.blocks = 0;
+        sh->cache_stats.bytes = 0;
+        pthread_mutex_unlock(&sh->lock);
+
+        for (int c = 0; c < CACHE_NR_CLASSES; c++) {
+            while (lists[c]) {
+                block_element_t *b = lists[c];
+                lists[c] = b->next;
+                free(b);
+            }
+        }
+    }
+    critical_exit();
+}
+
+/* Turn the profiling of allocations per call site on or off */
+void set_alloc_profile(bool enable)
+{
+    atomic_store(&profile_enabled, enable);
+}
+
+size_t alloc_sites(alloc_site_t *out, size_t n)
+{
+    critical_enter();
+    size_t cnt = 0;
+    pthread_mutex_lock(&sites_lock);
+    for (size_t s = 0; s < SITES_CAP; s++) {
+        if (!sites[s].allocs)
+            continue;
+        if (cnt < n)
+            out[cnt] = sites[s];
+        cnt++;
+    }
+    pthread_mutex_unlock(&sites_lock);
+    critical_exit();
+    return cnt;
+}
+
+alloc_cache_stats_t alloc_cache_stats()
+{
+    critical_enter();
+    alloc_cache_stats_t st = {0};
+    for (int i = 0; i < NR_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        st.hits += shards[i].cache_stats.hits;
+        st.misses += shards[i].cache_stats.misses;
+        st.blocks += shards[i].cache_stats.blocks;
+        st.bytes += shards[i].cache_stats.bytes;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    critical_exit();
+    return st;
+}
+
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
@@ -239,6 +876,16 @@ void set_noallocate_mode(bool noallocate)
     noallocate_mode = noallocate;
 }
 
+/* Mark the calling thread as a worker of a parallel command.
+ * Workers keep their own exception state and time limit.  Where threads
+ * cannot have timers of their own, workers never arm the time limit: the
+ * interval timer is process wide and is handled by the main thread.
+ */
+void set_worker_mode(bool worker)
+{
+    worker_mode = worker;
+}
+
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
@@ -256,9 +903,11 @@ bool exception_setup(bool limit_time)
         /* Got here from longjmp */
         jmp_ready = false;
         if (time_limited) {
-            alarm(0);
+            disarm_time_limit(false);
             time_limited = false;
         }
+        /* The code cut short may have been carving packed blocks */
+        pack_end();
 
         if (error_message)
             report_event(MSG_ERROR, error_message);
@@ -268,10 +917,8 @@ bool exception_setup(bool limit_time)
 
     /* Got here from initial call */
     jmp_ready = true;
-    if (limit_time) {
-        alarm(time_limit);
-        time_limited = true;
-    }
+    if (limit_time)
+        time_limited = arm_time_limit();
     return true;
 }
 
@@ -279,7 +926,7 @@ bool exception_setup(bool limit_time)
 void exception_cancel()
 {
     if (time_limited) {
-        alarm(0);
+        disarm_time_limit(true);
         time_limited = false;
     }
 
@@ -292,6 +939,10 @@ void trigger_exception(char *msg)
 {
     error_occurred = true;
     error_message = msg;
+    if (critical_depth) {
+        exception_deferred = true;
+        return;
+    }
     if (jmp_ready)
         siglongjmp(env, 1);
     else
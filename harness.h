@@ -16,26 +16,116 @@ void test_free(void *p);
 char *test_strdup(const char *s);
 /* FIXME: provide test_realloc as well */
 
+/* While packed is set, blocks allocated by the calling thread are carved
+ * one after the other out of large chunks, instead of coming from the cache
+ * of freed blocks or from malloc wherever they have free memory.  They are
+ * checked, counted and freed like any other block.
+ */
+void test_alloc_packed(bool packed);
+
+/* Block whose payload is aligned to a power of two, such as a cache line.
+ * It is checked and counted like any other and released with test_free.
+ */
+void *test_aligned_alloc(size_t alignment, size_t size);
+
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Allocations made through the harness by every thread */
+typedef struct {
+    size_t allocs; /* Blocks allocated */
+    size_t frees;  /* Blocks freed */
+    size_t bytes;  /* Payload bytes allocated */
+    size_t live;   /* Payload bytes still allocated */
+    size_t peak;   /* Largest value of live since alloc_peak_reset() */
+} alloc_counters_t;
+
+alloc_counters_t alloc_counters();
+
+/* Start measuring the peak of live bytes from their current value */
+void alloc_peak_reset();
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Time limit of exception_setup(true) in milliseconds, 1000 by default */
+extern int time_limit_ms;
+
+/*
+ * How much of each payload test_malloc and test_free fill with junk.
+ * POISON_FULL fills all of it, POISON_EDGES only the first and last cache
+ * line, and POISON_NONE nothing.  Headers and footers are checked at every
+ * level; lower levels only let uninitialized or freed data go unnoticed.
+ */
+enum { POISON_NONE, POISON_EDGES, POISON_FULL };
+extern int poison_level;
+
 /*
- * Set/unset cautious mode.
+ * Set/unset cautious mode for the calling thread.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
 void set_cautious_mode(bool cautious);
 
+/*
+ * Turn on/off the cache of freed blocks, shared by every thread.
+ * Small freed blocks are then kept by size class and reused by test_malloc
+ * instead of going back to malloc.  Turning it off releases them.
+ */
+void set_alloc_cache(bool enable);
+
+/* Activity of the cache of freed blocks */
+typedef struct {
+    size_t hits;   /* Allocations served from the cache */
+    size_t misses; /* Allocations passed to malloc while it was on */
+    size_t blocks; /* Freed blocks held */
+    size_t bytes;  /* Bytes held, headers and footers included */
+} alloc_cache_stats_t;
+
+alloc_cache_stats_t alloc_cache_stats();
+
+/*
+ * Turn on/off the profiling of allocations per call site, shared by every
+ * thread.  A call site is the return address of a call to test_malloc,
+ * test_calloc or test_strdup.
+ */
+void set_alloc_profile(bool enable);
+
+/* Payload sizes of up to 16, 64, 256, 1K, 4K, 16K and 64K bytes, and more */
+#define ALLOC_SIZE_BUCKETS 8
+
+/* Allocations profiled at one call site */
+typedef struct {
+    void *caller;  /* Return address of the call, NULL for other sites */
+    size_t allocs; /* Blocks allocated */
+    size_t frees;  /* Blocks freed */
+    size_t bytes;  /* Payload bytes allocated */
+    size_t live;   /* Payload bytes still allocated */
+    size_t peak;   /* Largest value of live */
+    size_t sizes[ALLOC_SIZE_BUCKETS]; /* Blocks allocated per size bucket */
+} alloc_site_t;
+
+/*
+ * Copy up to n profiled call sites to sites.
+ * Return the number of sites profiled so far, which may exceed n.
+ */
+size_t alloc_sites(alloc_site_t *sites, size_t n);
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
 void set_noallocate_mode(bool noallocate);
 
+/*
+ * Set/unset worker mode for the calling thread.
+ * Every thread has a time limit of its own where the platform allows timers
+ * per thread.  Elsewhere, workers of parallel commands run without the time
+ * limit of exception_setup().
+ */
+void set_worker_mode(bool worker);
+
 /* Return whether any errors have occurred since last time checked */
 bool error_check();
 
@@ -56,6 +146,7 @@ void trigger_exception(char *msg);
 /* Tested program use our versions of malloc and free */
 #define malloc test_malloc
 #define free test_free
+#define aligned_alloc test_aligned_alloc
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
@@ -0,0 +1,478 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define JOURNAL_MAGIC "lab0j\0\0\1"
+
+/* Records are gathered here and written out together */
+#define JOURNAL_BUF (64 * 1024)
+
+/* Room for ".<generation>" or ".tmp" after the journal path */
+#define SUFFIX_LEN 24
+
+/* The journal file: this header, then the records in the order they were
+ * appended.  Fields are in host byte order, like snapshots.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t gen;
+} journal_hdr_t;
+
+/* Followed by len bytes: the value of an insertion, or the argument of
+ * the operations which take one.  sum covers everything after itself.
+ */
+typedef struct {
+    uint32_t sum;
+    uint32_t len;
+    uint16_t op;
+    uint16_t type;
+} journal_rec_t;
+
+struct journal {
+    struct list_head *head;
+    char *path, *scratch;
+    int fd;
+    uint64_t gen;
+    int group, pending;
+    size_t compact_bytes, log_bytes, used;
+    journal_stats_t stats;
+    char buf[JOURNAL_BUF];
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* FNV-1a, enough to tell a torn record from a complete one */
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t checksum(const journal_rec_t *rec, const void *data)
+{
+    size_t skip = offsetof(journal_rec_t, len);
+    uint32_t h = fnv1a(2166136261u, (const char *) rec + skip,
+                       sizeof(*rec) - skip);
+    return fnv1a(h, data, rec->len);
+}
+
+static bool write_all(int fd, const void *data, size_t n)
+{
+    const char *p = data;
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+static const char *snapshot_name(journal_t *j, uint64_t gen)
+{
+    snprintf(j->scratch, strlen(j->path) + SUFFIX_LEN, "%s.%" PRIu64, j->path,
+             gen);
+    return j->scratch;
+}
+
+static bool sync_file(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = !fsync(fd);
+    close(fd);
+    return ok;
+}
+
+/* Make a rename in the directory of the journal durable */
+static bool sync_dir(journal_t *j)
+{
+    const char *slash = strrchr(j->path, '/');
+    if (!slash)
+        return sync_file(".");
+    size_t len = slash == j->path ? 1 : slash - j->path;
+    memcpy(j->scratch, j->path, len);
+    j->scratch[len] = '\0';
+    return sync_file(j->scratch);
+}
+
+static bool flush(journal_t *j)
+{
+    bool ok = write_all(j->fd, j->buf, j->used);
+    j->used = 0;
+    return ok;
+}
+
+static bool sync_records(journal_t *j)
+{
+    if (!flush(j) || fdatasync(j->fd))
+        return false;
+    j->pending = 0;
+    j->stats.syncs++;
+    return true;
+}
+
+/* Start journal generation gen, whose snapshot is already durable */
+static bool start_generation(journal_t *j, uint64_t gen)
+{
+    snprintf(j->scratch, strlen(j->path) + SUFFIX_LEN, "%s.tmp", j->path);
+    int fd = open(j->scratch, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    journal_hdr_t hdr = {.magic = JOURNAL_MAGIC, .gen = gen};
+    if (!write_all(fd, &hdr, sizeof(hdr)) || fdatasync(fd) ||
+        rename(j->scratch, j->path)) {
+        close(fd);
+        unlink(j->scratch);
+        return false;
+    }
+
+    /* The records of the previous generation are in the snapshot now */
+    if (j->fd >= 0)
+        close(j->fd);
+    j->fd = fd;
+    j->used = 0;
+    j->pending = 0;
+    j->log_bytes = 0;
+    sync_dir(j);
+    if (j->gen)
+        unlink(snapshot_name(j, j->gen));
+    j->gen = gen;
+    return true;
+}
+
+static bool compact(journal_t *j)
+{
+    const char *snap = snapshot_name(j, j->gen + 1);
+    if (!q_save(j->head, snap) || !sync_file(snap)) {
+        unlink(snap);
+        return false;
+    }
+    if (!start_generation(j, j->gen + 1)) {
+        unlink(snapshot_name(j, j->gen + 1));
+        return false;
+    }
+    j->stats.compactions++;
+    return true;
+}
+
+static bool append(journal_t *j, journal_rec_t *rec, const void *data)
+{
+    rec->sum = checksum(rec, data);
+    size_t n = sizeof(*rec) + rec->len;
+    if (j->used + n > JOURNAL_BUF && !flush(j))
+        return false;
+    if (n > JOURNAL_BUF) {
+        if (!write_all(j->fd, rec, sizeof(*rec)) ||
+            !write_all(j->fd, data, rec->len))
+            return false;
+    } else {
+        memcpy(j->buf + j->used, rec, sizeof(*rec));
+        memcpy(j->buf + j->used + sizeof(*rec), data, rec->len);
+        j->used += n;
+    }
+    j->log_bytes += n;
+    j->stats.records++;
+    j->stats.bytes += n;
+
+    if (j->group && ++j->pending >= j->group && !sync_records(j))
+        return false;
+    if (j->compact_bytes && j->log_bytes >= j->compact_bytes)
+        return compact(j);
+    return true;
+}
+
+bool journal_insert(journal_t *j, bool tail, const element_t *e)
+{
+    uint64_t t = now_ns();
+    journal_rec_t rec = {
+        .len = e->type == Q_INT ? sizeof(e->prefix) : e->len,
+        .op = tail ? J_INSERT_TAIL : J_INSERT_HEAD,
+        .type = e->type,
+    };
+    bool ok = append(j, &rec, e->type == Q_INT ? (const void *) &e->prefix
+                                               : (const void *) e->value);
+    j->stats.ns += now_ns() - t;
+    return ok;
+}
+
+bool journal_op(journal_t *j, journal_op_t op, int64_t arg)
+{
+    if (op <= J_INSERT_TAIL || op >= J_NR_OPS)
+        return false;
+    uint64_t t = now_ns();
+    journal_rec_t rec = {.op = op};
+    if (op == J_REVERSE_K || op == J_SORT)
+        rec.len = sizeof(arg);
+    bool ok = append(j, &rec, &arg);
+    j->stats.ns += now_ns() - t;
+    return ok;
+}
+
+bool journal_sync(journal_t *j)
+{
+    uint64_t t = now_ns();
+    bool ok = sync_records(j);
+    j->stats.ns += now_ns() - t;
+    return ok;
+}
+
+bool journal_compact(journal_t *j)
+{
+    uint64_t t = now_ns();
+    bool ok = compact(j);
+    j->stats.ns += now_ns() - t;
+    return ok;
+}
+
+journal_stats_t journal_stats(const journal_t *j)
+{
+    return j->stats;
+}
+
+/* Apply one record to head */
+static bool apply(struct list_head *head,
+                  const journal_rec_t *rec,
+                  const char *data)
+{
+    int64_t arg = 0;
+    if (rec->op == J_REVERSE_K || rec->op == J_SORT) {
+        if (rec->len != sizeof(arg))
+            return false;
+        memcpy(&arg, data, sizeof(arg));
+    }
+
+    element_t *e = NULL;
+    switch (rec->op) {
+    case J_INSERT_HEAD:
+    case J_INSERT_TAIL:
+        if (rec->type == Q_INT) {
+            uint64_t key;
+            if (rec->len != sizeof(key))
+                return false;
+            memcpy(&key, data, sizeof(key));
+            e = q_element_new_int((int64_t) (key ^ (UINT64_C(1) << 63)));
+        } else if (rec->type <= Q_BLOB) {
+            e = q_element_new(rec->type, data, rec->len);
+        }
+        if (!e)
+            return false;
+        if (rec->op == J_INSERT_HEAD)
+            list_add(&e->list, head);
+        else
+            list_add_tail(&e->list, head);
+        return true;
+    case J_REMOVE_HEAD:
+    case J_REMOVE_TAIL:
+        e = rec->op == J_REMOVE_HEAD ? q_remove_head(head, NULL, 0)
+                                     : q_remove_tail(head, NULL, 0);
+        if (e)
+            q_release_element(e);
+        return true;
+    case J_DELETE_MID:
+        q_delete_mid(head);
+        return true;
+    case J_DELETE_DUP:
+        q_delete_dup(head);
+        return true;
+    case J_SWAP:
+        q_swap(head);
+        return true;
+    case J_REVERSE:
+        q_reverse(head);
+        return true;
+    case J_REVERSE_K:
+        q_reverseK(head, (int) arg);
+        return true;
+    case J_SORT:
+        q_sort(head, arg);
+        return true;
+    case J_ASCEND:
+        q_ascend(head);
+        return true;
+    case J_DESCEND:
+        q_descend(head);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Apply the records of the mapped journal file, returning the offset just
+ * past the last complete one.
+ */
+static size_t replay(journal_t *j, const char *map, size_t size, bool *ok)
+{
+    size_t off = sizeof(journal_hdr_t);
+    *ok = true;
+    while (size - off >= sizeof(journal_rec_t)) {
+        /* Records follow each other unpadded, so copy the header out */
+        journal_rec_t rec;
+        memcpy(&rec, map + off, sizeof(rec));
+        const char *data = map + off + sizeof(rec);
+        if (size - off - sizeof(rec) < rec.len ||
+            rec.sum != checksum(&rec, data))
+            break;
+        if (!apply(j->head, &rec, data)) {
+            *ok = false;
+            break;
+        }
+        off += sizeof(rec) + rec.len;
+        j->stats.replayed++;
+    }
+    return off;
+}
+
+/* Rebuild the queue from the snapshot and records of an existing file */
+static bool recover(journal_t *j, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(journal_hdr_t))
+        return false;
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const journal_hdr_t *hdr = (const journal_hdr_t *) map;
+    bool ok = !memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+    if (ok && hdr->gen) {
+        struct list_head *snap = q_load(snapshot_name(j, hdr->gen));
+        ok = snap;
+        if (snap) {
+            list_splice_tail_init(snap, j->head);
+            q_free(snap);
+        }
+    }
+
+    size_t end = 0;
+    if (ok) {
+        j->gen = hdr->gen;
+        end = replay(j, map, st.st_size, &ok);
+    }
+    munmap(map, st.st_size);
+
+    /* Cut a torn record off, so that new records follow the last good one */
+    if (ok && end < (size_t) st.st_size)
+        ok = !ftruncate(fd, end);
+    if (ok) {
+        ok = lseek(fd, end, SEEK_SET) == (off_t) end;
+        j->log_bytes = end - sizeof(journal_hdr_t);
+    }
+    return ok;
+}
+
+journal_t *journal_open(const char *path,
+                        struct list_head *head,
+                        int group,
+                        size_t compact_bytes)
+{
+    if (!path || !head || group < 0)
+        return NULL;
+
+    size_t len = strlen(path);
+    journal_t *j = malloc(sizeof(journal_t));
+    if (!j)
+        return NULL;
+    j->path = malloc(len + 1);
+    j->scratch = malloc(len + SUFFIX_LEN);
+    if (!j->path || !j->scratch) {
+        free(j->path);
+        free(j->scratch);
+        free(j);
+        return NULL;
+    }
+    memcpy(j->path, path, len + 1);
+    j->head = head;
+    j->fd = -1;
+    j->gen = 0;
+    j->group = group;
+    j->pending = 0;
+    j->compact_bytes = compact_bytes;
+    j->log_bytes = 0;
+    j->used = 0;
+    memset(&j->stats, 0, sizeof(j->stats));
+
+    int fd = open(path, O_RDWR);
+    bool ok;
+    if (fd >= 0) {
+        j->fd = fd;
+        ok = list_empty(head);
+        if (ok && !(ok = recover(j, fd))) {
+            /* Drop what was recovered before the failure */
+            element_t *e, *safe;
+            list_for_each_entry_safe (e, safe, head, list)
+                q_release_element(e);
+            INIT_LIST_HEAD(head);
+        }
+    } else {
+        /* A new journal starts from a snapshot of what head already holds */
+        ok = errno == ENOENT &&
+             (list_empty(head) ? start_generation(j, 0) : compact(j));
+    }
+
+    if (!ok) {
+        if (j->fd >= 0)
+            close(j->fd);
+        free(j->path);
+        free(j->scratch);
+        free(j);
+        return NULL;
+    }
+    return j;
+}
+
+bool journal_unlink(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    journal_hdr_t hdr;
+    bool ok = read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+              !memcmp(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic));
+    close(fd);
+    if (!ok)
+        return false;
+
+    size_t size = strlen(path) + SUFFIX_LEN;
+    char *snap = hdr.gen ? malloc(size) : NULL;
+    if (snap) {
+        snprintf(snap, size, "%s.%" PRIu64, path, hdr.gen);
+        unlink(snap);
+        free(snap);
+    }
+    return !unlink(path);
+}
+
+bool journal_close(journal_t *j)
+{
+    if (!j)
+        return true;
+    bool ok = sync_records(j);
+    close(j->fd);
+    free(j->path);
+    free(j->scratch);
+    free(j);
+    return ok;
+}
@@ -0,0 +1,160 @@
+#ifndef LAB0_JOURNAL_H
+#define LAB0_JOURNAL_H
+
+/* Append-only journal of the changes made to one queue.
+ *
+ * Every change is appended to the journal file as a small binary record
+ * after it has been applied to the queue.  Records are buffered and
+ * written out together, and the file is synced once per group of records
+ * rather than once per record, so a crash loses at most the last group.
+ *
+ * Reopening the journal replays it: the queue is rebuilt from the latest
+ * snapshot, written with q_save(), followed by the records appended since.
+ * A record torn by a crash ends the replay and is cut off the file.  When
+ * the records outgrow a threshold the queue is compacted into a new
+ * snapshot and the journal starts over.  The journal file names its
+ * snapshot, "<path>.<generation>", so that a crash during compaction leaves
+ * either the old pair or the new one.
+ *
+ * Changes that cannot be replayed deterministically, such as a shuffle,
+ * are recorded with journal_compact() instead.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+#pragma GCC visibility push(default)
+
+/**
+ * journal_op_t - Change recorded by a journal record
+ * @J_INSERT_HEAD: element inserted at head, the record holds its value
+ * @J_INSERT_TAIL: element inserted at tail, the record holds its value
+ * @J_REMOVE_HEAD: q_remove_head()
+ * @J_REMOVE_TAIL: q_remove_tail()
+ * @J_DELETE_MID: q_delete_mid()
+ * @J_DELETE_DUP: q_delete_dup()
+ * @J_SWAP: q_swap()
+ * @J_REVERSE: q_reverse()
+ * @J_REVERSE_K: q_reverseK(), the argument is K
+ * @J_SORT: q_sort(), the argument is whether to sort descending
+ * @J_ASCEND: q_ascend()
+ * @J_DESCEND: q_descend()
+ */
+typedef enum {
+    J_INSERT_HEAD,
+    J_INSERT_TAIL,
+    J_REMOVE_HEAD,
+    J_REMOVE_TAIL,
+    J_DELETE_MID,
+    J_DELETE_DUP,
+    J_SWAP,
+    J_REVERSE,
+    J_REVERSE_K,
+    J_SORT,
+    J_ASCEND,
+    J_DESCEND,
+    J_NR_OPS,
+} journal_op_t;
+
+typedef struct journal journal_t;
+
+/**
+ * journal_stats_t - Activity of a journal since it was opened
+ * @replayed: records applied when the journal was opened
+ * @records: records appended
+ * @bytes: bytes of records appended
+ * @syncs: number of times the file was synced
+ * @compactions: number of snapshots written
+ * @ns: nanoseconds spent appending, writing, syncing and compacting
+ */
+typedef struct {
+    uint64_t replayed, records, bytes, syncs, compactions, ns;
+} journal_stats_t;
+
+/**
+ * journal_open() - Recover a queue from its journal and keep journaling it
+ * @path: journal file
+ * @head: queue to recover into, which has to be empty if @path exists
+ * @group: records per sync, 0 to only sync in journal_sync()
+ * @compact_bytes: size of the records that triggers a compaction, 0 for
+ *                 never
+ *
+ * If @path does not exist it is created, and @head is compacted into the
+ * first snapshot when it is not empty.
+ *
+ * Return: the journal, NULL if @path is not a journal, @head is not empty
+ * while @path exists, or the files could not be read or written
+ */
+journal_t *journal_open(const char *path,
+                        struct list_head *head,
+                        int group,
+                        size_t compact_bytes);
+
+/**
+ * journal_close() - Sync the journal and release it
+ * @j: journal, may be NULL
+ *
+ * The files stay, ready to be replayed.
+ *
+ * Return: true for success, false if the last records could not be synced
+ */
+bool journal_close(journal_t *j);
+
+/**
+ * journal_unlink() - Remove a journal file and its snapshot
+ * @path: journal file, which must not be open
+ *
+ * Return: true for success, false if @path is not a journal
+ */
+bool journal_unlink(const char *path);
+
+/**
+ * journal_insert() - Record the insertion of an element
+ * @j: journal
+ * @tail: whether @e was inserted at tail rather than head
+ * @e: the inserted element
+ *
+ * Return: true for success, false if the journal could not be written
+ */
+bool journal_insert(journal_t *j, bool tail, const element_t *e);
+
+/**
+ * journal_op() - Record a change other than an insertion
+ * @j: journal
+ * @op: the change
+ * @arg: argument of @op, ignored by operations which take none
+ *
+ * Return: true for success, false if the journal could not be written
+ */
+bool journal_op(journal_t *j, journal_op_t op, int64_t arg);
+
+/**
+ * journal_sync() - Write out and sync every record appended so far
+ * @j: journal
+ *
+ * Return: true for success, false if the file could not be written
+ */
+bool journal_sync(journal_t *j);
+
+/**
+ * journal_compact() - Replace the journal with a snapshot of its queue
+ * @j: journal
+ *
+ * Return: true for success, false if the files could not be written, in
+ * which case the journal is left as it was
+ */
+bool journal_compact(journal_t *j);
+
+/**
+ * journal_stats() - Get the activity of a journal
+ * @j: journal
+ *
+ * Return: the counters
+ */
+journal_stats_t journal_stats(const journal_t *j);
+
+#pragma GCC visibility pop
+
+#endif /* LAB0_JOURNAL_H */
@@ -428,6 +428,121 @@ static inline void list_move_tail(struct list_head *node,
          &entry->member != (head); entry = safe,                           \
         safe = list_entry(safe->member.next, __typeof__(*entry), member))
 
+/**
+ * LIST_PREFETCH_DISTANCE - Number of nodes the prefetching iterators run ahead
+ *
+ * A node is prefetched this many iterations before the loop body reaches it,
+ * so the wider the gap between the memory latency and the time spent per
+ * node, the larger it has to be. May be defined before including this file.
+ */
+#ifndef LIST_PREFETCH_DISTANCE
+#define LIST_PREFETCH_DISTANCE 4
+#endif
+
+/**
+ * list_prefetch() - Hint that memory is about to be read
+ * @addr: address to fetch into the cache, which is allowed to be invalid
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define list_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define list_prefetch(addr) ((void) (addr))
+#endif
+
+/**
+ * list_prefetch_start() - Start the lookahead of a prefetching iteration
+ * @node: first node the iteration visits
+ * @head: pointer to the head of the list
+ *
+ * Return: the node LIST_PREFETCH_DISTANCE positions after @node, or @head if
+ * the list ends before
+ */
+static inline struct list_head *list_prefetch_start(struct list_head *node,
+                                                    struct list_head *head)
+{
+    for (int i = 0; i < LIST_PREFETCH_DISTANCE && node != head; i++) {
+        node = node->next;
+        list_prefetch(node);
+    }
+    return node;
+}
+
+/**
+ * list_prefetch_step() - Advance the lookahead of a prefetching iteration
+ * @ahead: current lookahead node
+ * @head: pointer to the head of the list
+ *
+ * Reading @ahead was hinted one iteration ago, so the chase of the lookahead
+ * overlaps with the loop body; the node it moves to is hinted for the next
+ * step, and is in the cache by the time the iterator gets there.
+ *
+ * Return: the node after @ahead, or @head once the end has been reached
+ */
+static inline struct list_head *list_prefetch_step(struct list_head *ahead,
+                                                   struct list_head *head)
+{
+    if (ahead != head) {
+        ahead = ahead->next;
+        list_prefetch(ahead);
+    }
+    return ahead;
+}
+
+/**
+ * list_for_each_prefetch - Iterate over list nodes, prefetching ahead
+ * @node: list_head pointer used as iterator
+ * @ahead: list_head pointer to the node LIST_PREFETCH_DISTANCE positions
+ *         after @node, or the head near the end
+ * @head: pointer to the head of the list
+ *
+ * Same as list_for_each(). The body may in addition prefetch what the entry
+ * of @ahead points to, such as a separately allocated buffer. Pure pointer
+ * chasing with an empty body gains nothing, since the lookahead chases the
+ * same chain.
+ */
+#define list_for_each_prefetch(node, ahead, head)                        \
+    for (node = (head)->next, ahead = list_prefetch_start(node, (head)); \
+         node != (head);                                                 \
+         node = node->next, ahead = list_prefetch_step(ahead, (head)))
+
+/**
+ * list_for_each_entry_prefetch - Iterate over list entries, prefetching ahead
+ * @entry: pointer used as iterator
+ * @ahead: list_head pointer to the node LIST_PREFETCH_DISTANCE positions
+ *         after @entry, or the head near the end
+ * @head: pointer to the head of the list
+ * @member: name of the list_head member variable in struct type of @entry
+ *
+ * Same as list_for_each_entry(), see list_for_each_prefetch().
+ */
+#define list_for_each_entry_prefetch(entry, ahead, head, member)             \
+    for (entry = list_entry((head)->next, __typeof__(*entry), member),       \
+        ahead = list_prefetch_start(&entry->member, (head));                 \
+         &entry->member != (head);                                           \
+         entry = list_entry(entry->member.next, __typeof__(*entry), member), \
+        ahead = list_prefetch_step(ahead, (head)))
+
+/**
+ * list_for_each_entry_safe_prefetch - Iterate over list entries, prefetching
+ * ahead and allowing deletes
+ * @entry: pointer used as iterator
+ * @safe: @type pointer used to store info for next entry in list
+ * @ahead: list_head pointer to the node LIST_PREFETCH_DISTANCE positions
+ *         after @entry, or the head near the end
+ * @head: pointer to the head of the list
+ * @member: name of the list_head member variable in struct type of @entry
+ *
+ * Same as list_for_each_entry_safe(), see list_for_each_prefetch(). Only
+ * the current entry may be removed, which leaves the lookahead valid.
+ */
+#define list_for_each_entry_safe_prefetch(entry, safe, ahead, head, member) \
+    for (entry = list_entry((head)->next, __typeof__(*entry), member),      \
+        safe = list_entry(entry->member.next, __typeof__(*entry), member),  \
+        ahead = list_prefetch_start(&entry->member, (head));                \
+         &entry->member != (head); entry = safe,                            \
+        safe = list_entry(safe->member.next, __typeof__(*entry), member),   \
+        ahead = list_prefetch_step(ahead, (head)))
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
@@ -0,0 +1,278 @@
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "mpmc.h"
+
+#define CACHE_LINE 64
+
+typedef struct mpmc_node {
+    _Atomic(struct mpmc_node *) next;
+    char *value;
+} mpmc_node_t;
+
+struct mpmc {
+    alignas(CACHE_LINE) _Atomic(mpmc_node_t *) head;
+    alignas(CACHE_LINE) _Atomic(mpmc_node_t *) tail;
+};
+
+/* Hazard pointers held by one thread: slot 0 guards the node read from
+ * head or tail, slot 1 its successor.  Nodes the thread unlinked wait in
+ * retired until no hazard pointer refers to them.  Once the retired list
+ * reaches twice the number of hazard pointers a scan frees at least half
+ * of it, so the list never overflows.
+ */
+#define HP_PER_THREAD 2
+#define HP_TOTAL (HP_PER_THREAD * MPMC_MAX_THREADS)
+#define RETIRE_SCAN (2 * HP_TOTAL)
+
+typedef struct {
+    alignas(CACHE_LINE) _Atomic(void *) hp[HP_PER_THREAD];
+    atomic_bool used;
+    size_t nretired;
+    mpmc_node_t *retired[RETIRE_SCAN];
+} hp_rec_t;
+
+static hp_rec_t records[MPMC_MAX_THREADS];
+static _Thread_local hp_rec_t *self;
+static pthread_key_t self_key;
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+
+static int ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(void *const *) a;
+    uintptr_t y = (uintptr_t) *(void *const *) b;
+    return (x > y) - (x < y);
+}
+
+/* Free every retired node of rec that no thread currently guards */
+static void scan(hp_rec_t *rec)
+{
+    void *hazards[HP_TOTAL];
+    size_t n = 0;
+    for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+        if (!atomic_load(&records[i].used))
+            continue;
+        for (int j = 0; j < HP_PER_THREAD; j++) {
+            void *p = atomic_load(&records[i].hp[j]);
+            if (p)
+                hazards[n++] = p;
+        }
+    }
+    qsort(hazards, n, sizeof(hazards[0]), ptr_cmp);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < rec->nretired; i++) {
+        mpmc_node_t *node = rec->retired[i];
+        if (bsearch(&node, hazards, n, sizeof(hazards[0]), ptr_cmp))
+            rec->retired[kept++] = node;
+        else
+            free(node);
+    }
+    rec->nretired = kept;
+}
+
+static void retire(hp_rec_t *rec, mpmc_node_t *node)
+{
+    rec->retired[rec->nretired++] = node;
+    if (rec->nretired == RETIRE_SCAN)
+        scan(rec);
+}
+
+/* Give the slot of an exiting thread back.  Nodes it could not free yet
+ * stay in the record and are inherited by the next owner.
+ */
+static void release_self(void *arg)
+{
+    hp_rec_t *rec = arg;
+    for (int j = 0; j < HP_PER_THREAD; j++)
+        atomic_store(&rec->hp[j], NULL);
+    scan(rec);
+    atomic_store(&rec->used, false);
+}
+
+/* Scan the records of exited threads, whose nodes were still guarded when
+ * they exited and would otherwise wait for a new thread to take the slot.
+ * A record is claimed for the time of its scan, so that no thread takes
+ * it meanwhile.
+ */
+static void reclaim_orphans()
+{
+    for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+        bool expected = false;
+        if (!atomic_compare_exchange_strong(&records[i].used, &expected,
+                                            true))
+            continue;
+        if (records[i].nretired)
+            scan(&records[i]);
+        atomic_store(&records[i].used, false);
+    }
+}
+
+static void make_key()
+{
+    pthread_key_create(&self_key, release_self);
+}
+
+static hp_rec_t *acquire_self()
+{
+    if (self)
+        return self;
+
+    pthread_once(&self_once, make_key);
+    for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&records[i].used, &expected,
+                                           true)) {
+            self = &records[i];
+            pthread_setspecific(self_key, self);
+            return self;
+        }
+    }
+    return NULL;
+}
+
+/* Read *src into hazard pointer slot i, retrying until the published
+ * hazard is known to have been set while the node was still reachable.
+ */
+static mpmc_node_t *protect(hp_rec_t *rec,
+                            int i,
+                            _Atomic(mpmc_node_t *) *src)
+{
+    mpmc_node_t *p, *again = atomic_load(src);
+    do {
+        p = again;
+        atomic_store(&rec->hp[i], p);
+        again = atomic_load(src);
+    } while (p != again);
+    return p;
+}
+
+static void clear(hp_rec_t *rec)
+{
+    atomic_store_explicit(&rec->hp[0], NULL, memory_order_release);
+    atomic_store_explicit(&rec->hp[1], NULL, memory_order_release);
+}
+
+mpmc_t *mpmc_new()
+{
+    mpmc_t *q = aligned_alloc(CACHE_LINE, sizeof(mpmc_t));
+    mpmc_node_t *dummy = malloc(sizeof(mpmc_node_t));
+    if (!q || !dummy) {
+        free(q);
+        free(dummy);
+        return NULL;
+    }
+    atomic_init(&dummy->next, NULL);
+    dummy->value = NULL;
+    atomic_init(&q->head, dummy);
+    atomic_init(&q->tail, dummy);
+    return q;
+}
+
+void mpmc_free(mpmc_t *q)
+{
+    if (!q)
+        return;
+
+    /* The value of the dummy node was handed out by its dequeue */
+    mpmc_node_t *node = atomic_load(&q->head);
+    mpmc_node_t *next = atomic_load(&node->next);
+    free(node);
+    for (node = next; node; node = next) {
+        next = atomic_load(&node->next);
+        free(node->value);
+        free(node);
+    }
+    free(q);
+
+    /* No thread uses q any more, so only nodes of other queues can still
+     * be guarded
+     */
+    if (self && self->nretired)
+        scan(self);
+    reclaim_orphans();
+}
+
+bool mpmc_insert_tail(mpmc_t *q, const char *s)
+{
+    hp_rec_t *rec = acquire_self();
+    if (!q || !s || !rec)
+        return false;
+
+    mpmc_node_t *node = malloc(sizeof(mpmc_node_t));
+    size_t len = strlen(s);
+    char *value = malloc(len + 1);
+    if (!node || !value) {
+        free(node);
+        free(value);
+        return false;
+    }
+    memcpy(value, s, len + 1);
+    node->value = value;
+    atomic_init(&node->next, NULL);
+
+    for (;;) {
+        mpmc_node_t *tail = protect(rec, 0, &q->tail);
+        mpmc_node_t *next = atomic_load(&tail->next);
+        if (tail != atomic_load(&q->tail))
+            continue;
+        if (next) {
+            /* Help a producer that linked its node but has not swung the
+             * tail yet.
+             */
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&tail->next, &next, node)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, node);
+            break;
+        }
+    }
+    clear(rec);
+    return true;
+}
+
+bool mpmc_remove_head(mpmc_t *q, char *sp, size_t bufsize)
+{
+    hp_rec_t *rec = acquire_self();
+    if (!q || !rec)
+        return false;
+
+    mpmc_node_t *head;
+    char *value;
+    for (;;) {
+        head = protect(rec, 0, &q->head);
+        mpmc_node_t *tail = atomic_load(&q->tail);
+        mpmc_node_t *next = atomic_load(&head->next);
+        atomic_store(&rec->hp[1], next);
+        if (head != atomic_load(&q->head))
+            continue;
+        if (!next) {
+            clear(rec);
+            return false;
+        }
+        if (head == tail) {
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+        /* next becomes the dummy node, its value goes to whoever wins */
+        value = next->value;
+        if (atomic_compare_exchange_weak(&q->head, &head, next))
+            break;
+    }
+    clear(rec);
+    retire(rec, head);
+
+    if (sp && bufsize) {
+        size_t len = strnlen(value, bufsize - 1);
+        memcpy(sp, value, len);
+        sp[len] = '\0';
+    }
+    free(value);
+    return true;
+}
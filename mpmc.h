@@ -0,0 +1,68 @@
+#ifndef LAB0_MPMC_H
+#define LAB0_MPMC_H
+
+/* Lock-free multi-producer/multi-consumer string queue.
+ *
+ * This is the Michael-Scott queue: a singly linked list with a dummy node
+ * at its head, where producers swing the tail and consumers swing the head
+ * with compare-and-swap.  Nodes unlinked by consumers are reclaimed with
+ * hazard pointers, so no thread ever touches freed memory and no lock is
+ * taken on either path.
+ *
+ * Any number of threads may call mpmc_insert_tail() and mpmc_remove_head()
+ * concurrently.  mpmc_new() and mpmc_free() must not race with other calls
+ * on the same queue.  At most MPMC_MAX_THREADS threads may use the queues
+ * at the same time; the slot of a thread is released when it exits.
+ *
+ * Nodes and strings are allocated through the test harness, so qtest can
+ * check them for leaks and corruption while threads race on the queue.
+ * Nodes still waiting for reclamation are freed when their thread exits,
+ * or by mpmc_free() if another thread still guarded them at that time.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MPMC_MAX_THREADS 64
+
+typedef struct mpmc mpmc_t;
+
+/**
+ * mpmc_new() - Create an empty queue
+ *
+ * Return: the queue, NULL for allocation failed
+ */
+mpmc_t *mpmc_new();
+
+/**
+ * mpmc_free() - Free a queue and every string still in it
+ * @q: queue, may be NULL
+ */
+void mpmc_free(mpmc_t *q);
+
+/**
+ * mpmc_insert_tail() - Insert a copy of a string at the tail of a queue
+ * @q: queue
+ * @s: string to be copied
+ *
+ * Same contract as q_insert_tail().
+ *
+ * Return: true for success, false for allocation failed or q is NULL
+ */
+bool mpmc_insert_tail(mpmc_t *q, const char *s);
+
+/**
+ * mpmc_remove_head() - Remove the string at the head of a queue
+ * @q: queue
+ * @sp: buffer receiving up to bufsize - 1 characters of the string plus a
+ *      null terminator, may be NULL
+ * @bufsize: size of @sp
+ *
+ * Same contract as q_remove_head(), except that the string is released
+ * here instead of being returned inside an element.
+ *
+ * Return: true if a string was removed, false if q is NULL or empty
+ */
+bool mpmc_remove_head(mpmc_t *q, char *sp, size_t bufsize);
+
+#endif /* LAB0_MPMC_H */
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pqueue.h"
+
+/* Smallest capacity of the heap array once it is allocated */
+#define PQ_MIN_CAP 16
+
+/* In the min-max heap, node i has children 2i + 1 and 2i + 2.  Nodes on
+ * even levels, the root included, are no larger than any of their
+ * descendants, and nodes on odd levels no smaller.
+ */
+static inline bool min_level(size_t i)
+{
+    size_t level = 0;
+    for (i++; i > 1; i >>= 1)
+        level++;
+    return !(level & 1);
+}
+
+/* Whether a belongs closer to the root than b on a min or max level */
+static inline bool before(bool min, const element_t *a, const element_t *b)
+{
+    int c = q_element_cmp(a, b);
+    return min ? c < 0 : c > 0;
+}
+
+static inline void swap(element_t **h, size_t i, size_t j)
+{
+    element_t *t = h[i];
+    h[i] = h[j];
+    h[j] = t;
+}
+
+/* Move h[i] up through the levels of its own kind */
+static void bubble_up_level(element_t **h, size_t i, bool min)
+{
+    while (i > 2) {
+        size_t g = ((i - 1) / 2 - 1) / 2;
+        if (!before(min, h[i], h[g]))
+            break;
+        swap(h, i, g);
+        i = g;
+    }
+}
+
+/* Restore the heap after h[i] was appended */
+static void bubble_up(element_t **h, size_t i)
+{
+    if (!i)
+        return;
+    size_t p = (i - 1) / 2;
+    bool min = min_level(i);
+    if (before(!min, h[i], h[p])) {
+        swap(h, i, p);
+        bubble_up_level(h, p, !min);
+    } else {
+        bubble_up_level(h, i, min);
+    }
+}
+
+/* Restore the heap below h[i], whose subtrees are heaps */
+static void trickle_down(element_t **h, size_t n, size_t i)
+{
+    bool min = min_level(i);
+    for (;;) {
+        /* Best of h[i], its children and its grandchildren */
+        size_t m = i, first = 2 * i + 1;
+        for (size_t k = first; k < first + 2 && k < n; k++) {
+            if (before(min, h[k], h[m]))
+                m = k;
+        }
+        for (size_t k = 2 * first + 1; k < 2 * first + 5 && k < n; k++) {
+            if (before(min, h[k], h[m]))
+                m = k;
+        }
+        if (m == i)
+            return;
+
+        swap(h, i, m);
+        if (m < 2 * first + 1)
+            return;
+        /* A grandchild moved down may now be out of order with its parent */
+        size_t p = (m - 1) / 2;
+        if (before(!min, h[m], h[p]))
+            swap(h, m, p);
+        i = m;
+    }
+}
+
+/* Make room for at least n elements.  Return false if it cannot be. */
+static bool reserve(pqueue_t *pq, size_t n)
+{
+    if (n <= pq->cap)
+        return true;
+    size_t cap = pq->cap ? pq->cap : PQ_MIN_CAP;
+    while (cap < n)
+        cap *= 2;
+    element_t **heap = malloc(cap * sizeof(element_t *));
+    if (!heap)
+        return false;
+    if (pq->size)
+        memcpy(heap, pq->heap, pq->size * sizeof(element_t *));
+    free(pq->heap);
+    pq->heap = heap;
+    pq->cap = cap;
+    return true;
+}
+
+/* Release the array of an empty queue, so that it holds no memory */
+static void release_if_empty(pqueue_t *pq)
+{
+    if (pq->size)
+        return;
+    free(pq->heap);
+    pq->heap = NULL;
+    pq->cap = 0;
+}
+
+/* Index of the largest element of a non-empty heap */
+static size_t max_index(const pqueue_t *pq)
+{
+    if (pq->size < 3)
+        return pq->size - 1;
+    return before(false, pq->heap[2], pq->heap[1]) ? 2 : 1;
+}
+
+static element_t *pop(pqueue_t *pq, size_t i)
+{
+    element_t **h = pq->heap;
+    element_t *e = h[i];
+    h[i] = h[--pq->size];
+    if (i < pq->size)
+        trickle_down(h, pq->size, i);
+    release_if_empty(pq);
+    INIT_LIST_HEAD(&e->list);
+    return e;
+}
+
+void pq_init(pqueue_t *pq)
+{
+    pq->heap = NULL;
+    pq->size = pq->cap = 0;
+}
+
+bool pq_push(pqueue_t *pq, element_t *e)
+{
+    if (!pq || !e || !reserve(pq, pq->size + 1))
+        return false;
+    pq->heap[pq->size] = e;
+    bubble_up(pq->heap, pq->size++);
+    return true;
+}
+
+bool pq_from_queue(pqueue_t *pq, struct list_head *head)
+{
+    if (!pq || !head || !reserve(pq, pq->size + q_size(head)))
+        return false;
+
+    struct list_head *node;
+    list_for_each (node, head)
+        pq->heap[pq->size++] = list_entry(node, element_t, list);
+    INIT_LIST_HEAD(head);
+
+    /* Floyd's construction: trickle every internal node down, bottom up */
+    for (size_t i = pq->size / 2; i-- > 0;)
+        trickle_down(pq->heap, pq->size, i);
+    return true;
+}
+
+element_t *pq_peek_min(const pqueue_t *pq)
+{
+    return pq && pq->size ? pq->heap[0] : NULL;
+}
+
+element_t *pq_peek_max(const pqueue_t *pq)
+{
+    return pq && pq->size ? pq->heap[max_index(pq)] : NULL;
+}
+
+element_t *q_pop_min(pqueue_t *pq)
+{
+    return pq && pq->size ? pop(pq, 0) : NULL;
+}
+
+element_t *q_pop_max(pqueue_t *pq)
+{
+    return pq && pq->size ? pop(pq, max_index(pq)) : NULL;
+}
+
+void pq_free(pqueue_t *pq)
+{
+    if (!pq)
+        return;
+    for (size_t i = 0; i < pq->size; i++)
+        q_release_element(pq->heap[i]);
+    pq->size = 0;
+    release_if_empty(pq);
+}
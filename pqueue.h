@@ -0,0 +1,103 @@
+#ifndef LAB0_PQUEUE_H
+#define LAB0_PQUEUE_H
+
+/* Double-ended priority queue of queue elements, implemented as a min-max
+ * heap.
+ *
+ * The heap is an array of element pointers whose even levels are ordered
+ * as a min-heap and odd levels as a max-heap: the root holds the minimum
+ * and one of its children the maximum, so both ends are found in O(1) and
+ * removed in O(log n), in any order.  Pushing an element copies neither it
+ * nor its value, only the array grows.  While an element is owned by a
+ * priority queue its list links are unused, so it must not be linked into
+ * a queue at the same time.  Priorities are the element values, ordered by
+ * q_element_cmp(), so strings, integers and blobs are all supported.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+#pragma GCC visibility push(default)
+
+typedef struct {
+    element_t **heap; /* NULL while the queue is empty */
+    size_t size, cap;
+} pqueue_t;
+
+/**
+ * pq_init() - Initialize an empty priority queue
+ * @pq: priority queue to initialize
+ */
+void pq_init(pqueue_t *pq);
+
+/**
+ * pq_push() - Add an element to a priority queue in O(log n)
+ * @pq: priority queue
+ * @e: unlinked element, e.g. from q_element_new()
+ *
+ * Return: true for success, false for allocation failed, in which case the
+ * caller still owns @e
+ */
+bool pq_push(pqueue_t *pq, element_t *e);
+
+/**
+ * pq_from_queue() - Move every element of a queue into a priority queue
+ * @pq: priority queue
+ * @head: header of queue, left empty on success
+ *
+ * The heap is rebuilt in O(n) for the elements of @pq and @head together.
+ *
+ * Return: true for success, false for allocation failed, in which case
+ * both are left as they were
+ */
+bool pq_from_queue(pqueue_t *pq, struct list_head *head);
+
+/**
+ * pq_peek_min() - Smallest element of a priority queue, in O(1)
+ * @pq: priority queue
+ *
+ * Return: the element, still owned by @pq, or NULL if @pq is empty
+ */
+element_t *pq_peek_min(const pqueue_t *pq);
+
+/**
+ * pq_peek_max() - Largest element of a priority queue, in O(1)
+ * @pq: priority queue
+ *
+ * Return: the element, still owned by @pq, or NULL if @pq is empty
+ */
+element_t *pq_peek_max(const pqueue_t *pq);
+
+/**
+ * q_pop_min() - Remove the smallest element of a priority queue
+ * @pq: priority queue
+ *
+ * Runs in O(log n) whatever was removed before.  Ties are removed in no
+ * particular order.
+ *
+ * Return: the unlinked element, or NULL if @pq is empty.  The caller owns
+ * it and releases it with q_release_element().
+ */
+element_t *q_pop_min(pqueue_t *pq);
+
+/**
+ * q_pop_max() - Remove the largest element of a priority queue
+ * @pq: priority queue
+ *
+ * Same as q_pop_min(), for the other end.
+ *
+ * Return: the unlinked element, or NULL if @pq is empty
+ */
+element_t *q_pop_max(pqueue_t *pq);
+
+/**
+ * pq_free() - Release every element of a priority queue
+ * @pq: priority queue, left empty on return
+ */
+void pq_free(pqueue_t *pq);
+
+#pragma GCC visibility pop
+
+#endif /* LAB0_PQUEUE_H */
@@ -1,10 +1,16 @@
 /* Implementation of testing code for queue code */
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <execinfo.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,7 +51,13 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "cqueue.h"
+#include "journal.h"
+#include "mpmc.h"
+#include "pqueue.h"
+#include "tpool.h"
 #include "report.h"
+#include "shmq.h"
 
 /* Settable parameters */
 
@@ -53,7 +65,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -65,16 +76,58 @@ typedef struct {
 } queue_chain_t;
 
 static queue_chain_t chain = {.size = 0};
-static queue_contex_t *current = NULL;
+/* Per thread, so that parallel commands each work on their own queue */
+static _Thread_local queue_contex_t *current = NULL;
+
+/* Worker threads of the parallel commands */
+static tpool_t *pool = NULL;
+static int pool_threads = 4;
+
+/* Worker threads of merge, which is serial when merge_threads is 0 */
+static tpool_t *merge_pool = NULL;
+static int merge_threads = 0;
+
+/* Thread freeing the queues released by free when async_free is set */
+static tpool_t *reclaimer = NULL;
+static int async_free = 0;
+
+/* Whether the harness recycles small freed blocks */
+static int alloc_cache = 0;
+
+/* Whether the harness profiles allocations per call site */
+static int alloc_profile = 0;
+
+/* Priority queue driven by the pq* commands */
+static pqueue_t pq;
+
+/* Compact queue driven by the cq* commands, created on first use */
+static cqueue_t *cq = NULL;
+
+/* Shared-memory queue driven by the shm* commands, and its name if this
+ * process created it, so that detaching unlinks it.
+ */
+static shmq_t *shm = NULL;
+static char shm_owned[MAXSTRING + 2];
+
+/* Journal of one queue of the chain, driven by the j* commands */
+static journal_t *journal = NULL;
+static queue_contex_t *journaled = NULL;
+static int journal_group = 32;
+static int journal_compact_kb = 1024;
 
 /* How many times can queue operations fail */
 static int fail_limit = BIG_LIST_SIZE;
-static int fail_count = 0;
+static atomic_int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Type of the values inserted by ih/it, see q_type_t */
+static int elem_type = Q_STR;
+static const char *const elem_type_names[] = {"str", "int", "blob", NULL};
+static const char *const poison_names[] = {"none", "edges", "full", NULL};
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -86,6 +139,63 @@ typedef enum {
 /* Forward declarations */
 static bool q_show(int vlevel);
 
+/* Record a change made to queue ctx if it is the journaled one */
+static bool journal_note(queue_contex_t *ctx, journal_op_t op, int64_t arg)
+{
+    if (!journal || ctx != journaled || journal_op(journal, op, arg))
+        return true;
+    report(1, "ERROR: Could not write journal");
+    return false;
+}
+
+/* Record a change which cannot be replayed by taking a snapshot */
+static bool journal_snapshot(queue_contex_t *ctx)
+{
+    if (!journal || ctx != journaled || journal_compact(journal))
+        return true;
+    report(1, "ERROR: Could not compact journal");
+    return false;
+}
+
+/* Record the element just inserted at the head or tail of current */
+static bool journal_note_insert(bool tail)
+{
+    if (!journal || current != journaled)
+        return true;
+    element_t *e = tail ? list_last_entry(current->q, element_t, list)
+                        : list_first_entry(current->q, element_t, list);
+    if (journal_insert(journal, tail, e))
+        return true;
+    report(1, "ERROR: Could not write journal");
+    return false;
+}
+
+/* Stop journaling, keeping the files for a later jopen */
+static bool journal_stop()
+{
+    bool ok = journal_close(journal);
+    if (!ok)
+        report(1, "ERROR: Could not sync journal");
+    journal = NULL;
+    journaled = NULL;
+    return ok;
+}
+
+/* Reclaimer thread, started on first use, NULL if it could not be */
+static tpool_t *get_reclaimer()
+{
+    if (!reclaimer)
+        reclaimer = tpool_new(1);
+    return reclaimer;
+}
+
+/* Wait for the queues handed to the reclaimer to be freed */
+static void reclaim_wait()
+{
+    if (reclaimer)
+        tpool_wait(reclaimer);
+}
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -101,22 +211,27 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
                                                      : current->chain.next;
     }
 
+    if (current && current == journaled) {
+        report(3, "Closing the journal of the freed queue");
+        ok = journal_stop();
+    }
+
     if (current) {
         list_del(&current->chain);
 
-        if (exception_setup(true))
-            q_free(current->q);
+        if (exception_setup(true)) {
+            if (async_free)
+                q_free_async(current->q, get_reclaimer());
+            else
+                q_free(current->q);
+        }
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -127,8 +242,11 @@ static bool do_free(int argc, char *argv[])
 
     q_show(3);
 
+    /* Blocks still queued for the reclaimer are not leaks */
+    if (!chain.size && !pq.size)
+        reclaim_wait();
     size_t bcnt = allocation_check();
-    if (!chain.size && bcnt > 0) {
+    if (!chain.size && !pq.size && !cq && bcnt > 0) {
         report(1,
                "ERROR: There is no queue, but %lu blocks are still allocated",
                bcnt);
@@ -138,6 +256,109 @@ static bool do_free(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_reclaim(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    reclaim_wait();
+    report(3, "%lu blocks allocated", allocation_check());
+    return true;
+}
+
+static int site_by_allocs(const void *a, const void *b)
+{
+    size_t x = ((const alloc_site_t *) a)->allocs;
+    size_t y = ((const alloc_site_t *) b)->allocs;
+    return (x < y) - (x > y);
+}
+
+static int site_by_bytes(const void *a, const void *b)
+{
+    size_t x = ((const alloc_site_t *) a)->bytes;
+    size_t y = ((const alloc_site_t *) b)->bytes;
+    return (x < y) - (x > y);
+}
+
+static int site_by_peak(const void *a, const void *b)
+{
+    size_t x = ((const alloc_site_t *) a)->peak;
+    size_t y = ((const alloc_site_t *) b)->peak;
+    return (x < y) - (x > y);
+}
+
+/* Show the top sites of the allocation profile under one ordering */
+static void show_sites(alloc_site_t *sites,
+                       size_t cnt,
+                       int top,
+                       const char *key,
+                       int (*cmp)(const void *, const void *))
+{
+    static const char *const buckets[ALLOC_SIZE_BUCKETS] = {
+        "16", "64", "256", "1K", "4K", "16K", "64K", "more"};
+
+    qsort(sites, cnt, sizeof(*sites), cmp);
+    report(1, "Top allocation sites by %s:", key);
+    report(1, "  %10s %10s %12s %12s %12s  %s", "allocs", "frees", "bytes",
+           "live", "peak", "site");
+    for (size_t i = 0; i < cnt && i < (size_t) top; i++) {
+        alloc_site_t *st = &sites[i];
+        /* Of the form "./qtest(q_insert_head+0x3c) [0x...]" */
+        char **sym = st->caller ? backtrace_symbols(&st->caller, 1) : NULL;
+        char *name = sym ? sym[0] : "(other sites)";
+        report(1, "  %10zu %10zu %12zu %12zu %12zu  %.*s", st->allocs,
+               st->frees, st->bytes, st->live, st->peak,
+               (int) strcspn(name, " "), name);
+        free(sym);
+
+        char hist[256];
+        int len = 0;
+        for (int k = 0; k < ALLOC_SIZE_BUCKETS; k++) {
+            if (st->sizes[k] && len < (int) sizeof(hist))
+                len += snprintf(hist + len, sizeof(hist) - len, " %s%s:%zu",
+                                k < ALLOC_SIZE_BUCKETS - 1 ? "<=" : "",
+                                buckets[k], st->sizes[k]);
+        }
+        report(2, "  %10s sizes%s", "", hist);
+    }
+}
+
+static bool do_allocstats(int argc, char *argv[])
+{
+    int top = 5;
+    if (argc > 2 || (argc == 2 && (!get_int(argv[1], &top) || top < 1))) {
+        report(1, "%s takes an optional positive number of sites", argv[0]);
+        return false;
+    }
+
+    alloc_cache_stats_t st = alloc_cache_stats();
+    size_t calls = st.hits + st.misses;
+    report(1, "%lu blocks allocated", allocation_check());
+    report(1,
+           "Allocation cache %s: %zu hits, %zu misses (%.1f%% hit rate), "
+           "%zu blocks of %zu bytes cached",
+           alloc_cache ? "on" : "off", st.hits, st.misses,
+           calls ? 100.0 * st.hits / calls : 0.0, st.blocks, st.bytes);
+
+    size_t cnt = alloc_sites(NULL, 0);
+    if (!cnt)
+        return true;
+    alloc_site_t *sites = malloc(cnt * sizeof(*sites));
+    if (!sites) {
+        report(1, "ERROR: Could not allocate the allocation profile");
+        return false;
+    }
+    /* Sites are never dropped, so there are at least cnt of them */
+    alloc_sites(sites, cnt);
+    show_sites(sites, cnt, top, "blocks", site_by_allocs);
+    show_sites(sites, cnt, top, "bytes", site_by_bytes);
+    show_sites(sites, cnt, top, "peak live bytes", site_by_peak);
+    free(sites);
+    return true;
+}
+
 static bool do_new(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -163,6 +384,175 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_clone(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling clone on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true;
+    if (exception_setup(true)) {
+        struct list_head *copy = q_clone(current->q);
+        if (!copy) {
+            report(1, "ERROR: Could not clone queue");
+            ok = false;
+        } else {
+            queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+            list_add_tail(&qctx->chain, &chain.head);
+
+            qctx->size = current->size;
+            qctx->q = copy;
+            qctx->id = chain.size++;
+
+            current = qctx;
+        }
+    }
+    exception_cancel();
+
+    if (ok && q_size(current->q) != current->size) {
+        report(1, "ERROR: Clone does not have the size of the original");
+        ok = false;
+    }
+    q_show(3);
+
+    return ok && !error_check();
+}
+
+/* Nanoseconds a walk over every element and its value takes */
+static double walk_ns(struct list_head *q)
+{
+    struct timespec t0, t1;
+    volatile char sink = 0;
+    element_t *e;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    list_for_each_entry (e, q, list) {
+        if (e->value)
+            sink ^= e->value[0];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    (void) sink;
+    return 1e9 * (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec);
+}
+
+static bool do_compact(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling compact on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = false;
+    q_compact_stats_t st;
+    double before = walk_ns(current->q), after = 0;
+    if (exception_setup(true))
+        ok = q_compact(current->q, &st);
+    exception_cancel();
+
+    if (!ok) {
+        report(1, "ERROR: Could not compact queue");
+        return false;
+    }
+    after = walk_ns(current->q);
+    ok = q_size(current->q) == current->size;
+    if (!ok)
+        report(1, "ERROR: Compacted queue does not have its original size");
+
+    report(1,
+           "Compacted %zu elements, %zu shared buffers kept; links across "
+           "pages: %zu -> %zu",
+           st.moved, st.shared, st.far_before, st.far_after);
+    if (st.pages_after)
+        report(1, "Pages in use: %zu -> %zu, %zu reclaimed", st.pages_before,
+               st.pages_after,
+               st.pages_before > st.pages_after
+                   ? st.pages_before - st.pages_after
+                   : 0);
+    report(2, "Traversal: %.0f ns -> %.0f ns (%.2fx)", before, after,
+           after > 0 ? before / after : 1.0);
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling save on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_save(current->q, argv[1]);
+    exception_cancel();
+
+    if (!ok)
+        report(1, "ERROR: Could not save queue to %s", argv[1]);
+    else
+        report(2, "Saved %d elements to %s", current->size, argv[1]);
+    return ok && !error_check();
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    error_check();
+
+    struct list_head *q = NULL;
+    if (exception_setup(true))
+        q = q_load(argv[1]);
+    exception_cancel();
+    if (!q) {
+        report(1, "ERROR: Could not load queue from %s", argv[1]);
+        return false;
+    }
+
+    /* Every queue of the chain has to hold values of the current type */
+    int cnt = 0;
+    element_t *e;
+    list_for_each_entry (e, q, list) {
+        if (e->type != (uint32_t) elem_type) {
+            report(1, "ERROR: %s holds values of another type than %s",
+                   argv[1], elem_type_names[elem_type]);
+            q_free(q);
+            return false;
+        }
+        cnt++;
+    }
+
+    queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+    list_add_tail(&qctx->chain, &chain.head);
+    qctx->size = cnt;
+    qctx->q = q;
+    qctx->id = chain.size++;
+    current = qctx;
+
+    report(2, "Loaded %d elements from %s", cnt, argv[1]);
+    q_show(3);
+    return !error_check();
+}
+
 /* TODO: Add a buf_size check of if the buf_size may be less
  * than MIN_RANDSTR_LEN.
  */
@@ -178,6 +568,145 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/* Parse a command argument as a value of the current element type into the
+ * probe element e. Strings are referenced in place, blobs are unescaped
+ * ("\xNN" and "\\") into buf, which must hold strlen(arg) + 1 bytes.
+ */
+static bool parse_value(char *arg, element_t *e, char *buf)
+{
+    e->type = elem_type;
+    if (elem_type == Q_INT) {
+        char *end = NULL;
+        errno = 0;
+        long long v = strtoll(arg, &end, 0);
+        if (errno || end == arg || *end != '\0')
+            return false;
+        q_element_setint(e, v);
+        return true;
+    }
+
+    if (elem_type == Q_STR) {
+        e->value = arg;
+        q_element_setkey(e, strlen(arg));
+        return true;
+    }
+
+    size_t len = 0;
+    for (char *c = arg; *c; c++) {
+        if (c[0] == '\\' && c[1] == '\\') {
+            buf[len++] = *++c;
+        } else if (c[0] == '\\' && c[1] == 'x' && isxdigit(c[2]) &&
+                   isxdigit(c[3])) {
+            char hex[3] = {c[2], c[3], '\0'};
+            buf[len++] = (char) strtol(hex, NULL, 16);
+            c += 3;
+        } else if (c[0] == '\\') {
+            return false;
+        } else {
+            buf[len++] = *c;
+        }
+    }
+    buf[len] = '\0';
+    e->value = buf;
+    q_element_setkey(e, len);
+    return true;
+}
+
+/* Render the value of an element in the syntax accepted by parse_value() */
+static const char *format_value(const element_t *e, char *buf, size_t size)
+{
+    if (e->type == Q_INT) {
+        snprintf(buf, size, "%" PRId64, q_element_int(e));
+        return buf;
+    }
+    if (e->type != Q_BLOB)
+        return e->value;
+
+    size_t n = 0;
+    for (uint32_t i = 0; i < e->len && n + 5 <= size; i++) {
+        unsigned char c = e->value[i];
+        if (c == '\\')
+            n += snprintf(buf + n, size - n, "\\\\");
+        else if (isgraph(c))
+            buf[n++] = c;
+        else
+            n += snprintf(buf + n, size - n, "\\x%02x", c);
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+/* Fill the probe element e with a random value of the current type */
+static void fill_rand_value(element_t *e, char *buf, size_t buf_size)
+{
+    e->type = elem_type;
+    if (elem_type == Q_STR) {
+        fill_rand_string(buf, buf_size);
+        e->value = buf;
+        q_element_setkey(e, strlen(buf));
+    } else if (elem_type == Q_INT) {
+        int64_t v;
+        randombytes((uint8_t *) &v, sizeof(v));
+        q_element_setint(e, v);
+    } else {
+        size_t len = 0;
+        while (len < MIN_RANDSTR_LEN)
+            len = rand() % buf_size;
+        randombytes((uint8_t *) buf, len);
+        buf[len] = '\0';
+        e->value = buf;
+        q_element_setkey(e, len);
+    }
+}
+
+/* Insert the value held by the probe element e into the current queue */
+static bool insert_value(position_t pos, element_t *e)
+{
+    bool tail = pos == POS_TAIL;
+    switch (e->type) {
+    case Q_INT:
+        return tail ? q_insert_tail_int(current->q, q_element_int(e))
+                    : q_insert_head_int(current->q, q_element_int(e));
+    case Q_BLOB:
+        return tail ? q_insert_tail_blob(current->q, e->value, e->len)
+                    : q_insert_head_blob(current->q, e->value, e->len);
+    default:
+        return tail ? q_insert_tail(current->q, e->value)
+                    : q_insert_head(current->q, e->value);
+    }
+}
+
+/* Element types may only change while every queue is empty */
+static void elem_type_changed(int oldval)
+{
+    if (elem_type < Q_STR || elem_type > Q_BLOB) {
+        report(1, "ERROR: Unknown element type %d", elem_type);
+        elem_type = oldval;
+        return;
+    }
+
+    struct list_head *cur;
+    list_for_each (cur, &chain.head) {
+        queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
+        if (ctx->q && !list_empty(ctx->q)) {
+            report(1, "ERROR: Cannot change element type of non-empty queue");
+            elem_type = oldval;
+            return;
+        }
+    }
+    if (pq.size) {
+        report(1, "ERROR: Cannot change element type of non-empty priority "
+                  "queue");
+        elem_type = oldval;
+        return;
+    }
+    if (cq) {
+        report(1, "ERROR: Cannot change element type while the compact queue "
+                  "exists");
+        elem_type = oldval;
+    }
+}
+
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
@@ -199,6 +728,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
 
     char *lasts = NULL;
     char randstr_buf[MAX_RANDSTR_LEN];
+    char vbuf[MAXSTRING + 1];
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -214,9 +744,19 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         }
     }
 
+    element_t probe;
+    char *blob_buf = malloc(strlen(inserts) + 1);
+    if (!blob_buf) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for value");
+        return false;
+    }
     if (!strcmp(inserts, "RAND")) {
         need_rand = true;
-        inserts = randstr_buf;
+    } else if (!parse_value(inserts, &probe, blob_buf)) {
+        report(1, "Invalid %s value '%s'", elem_type_names[elem_type],
+               inserts);
+        free(blob_buf);
+        return false;
     }
 
     if (!current || !current->q)
@@ -227,9 +767,8 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
-                                        : q_insert_head(current->q, inserts);
+                fill_rand_value(&probe, randstr_buf, sizeof(randstr_buf));
+            bool rval = insert_value(pos, &probe);
             if (rval) {
                 current->size++;
                 element_t *entry =
@@ -237,31 +776,42 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                         ? list_last_entry(current->q, element_t, list)
                         : list_first_entry(current->q, element_t, list);
                 char *cur_inserts = entry->value;
-                if (!cur_inserts) {
+                if (probe.type != Q_INT && !cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
-                } else if (r == 0 && inserts == cur_inserts) {
+                } else if (r == 0 && probe.type != Q_INT &&
+                           probe.value == cur_inserts) {
                     report(1,
                            "ERROR: Need to allocate and copy string for new "
                            "queue element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == cur_inserts) {
+                } else if (r == 1 && probe.type != Q_INT &&
+                           lasts == cur_inserts) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "queue element");
                     ok = false;
                     break;
+                } else if (!q_element_equal(entry, &probe)) {
+                    report(1, "ERROR: Inserted value %s was not stored",
+                           format_value(&probe, vbuf, sizeof(vbuf)));
+                    ok = false;
+                    break;
                 }
                 lasts = cur_inserts;
+                if (!journal_note_insert(pos == POS_TAIL))
+                    ok = false;
             } else {
                 fail_count++;
                 if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
+                    report(2, "Insertion of %s failed",
+                           format_value(&probe, vbuf, sizeof(vbuf)));
                 else {
                     report(1,
                            "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
+                           format_value(&probe, vbuf, sizeof(vbuf)),
+                           fail_count);
                     ok = false;
                 }
             }
@@ -269,6 +819,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         }
     }
     exception_cancel();
+    free(blob_buf);
 
     q_show(3);
     return ok;
@@ -332,9 +883,21 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
 
     bool check = argc > 1;
     bool ok = true;
-    if (check) {
+    element_t probe;
+    char *blob_buf = NULL;
+    if (check && elem_type == Q_STR) {
         strncpy(checks, argv[1], string_length + 1);
         checks[string_length] = '\0';
+    } else if (check) {
+        blob_buf = malloc(strlen(argv[1]) + 1);
+        if (!blob_buf || !parse_value(argv[1], &probe, blob_buf)) {
+            report(1, "Invalid %s value '%s'", elem_type_names[elem_type],
+                   argv[1]);
+            free(blob_buf);
+            free(removes);
+            free(checks);
+            return false;
+        }
     }
 
     removes[0] = '\0';
@@ -354,14 +917,28 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
     exception_cancel();
 
     bool is_null = re ? false : true;
+    char vbuf[MAXSTRING + 1];
 
     if (!is_null) {
+        /* Strings are checked through the copy in removes, which honors the
+         * length option. Other types are compared as elements.
+         */
+        if (re->type != Q_STR) {
+            if (ok && check && !q_element_equal(re, &probe)) {
+                report(1, "ERROR: Removed value %s != expected value %s",
+                       format_value(re, vbuf, sizeof(vbuf)), argv[1]);
+                ok = false;
+            }
+            format_value(re, vbuf, sizeof(vbuf));
+        }
         // q_remove_head and q_remove_tail are not responsible for releasing
         // node
+        bool stored = re->type != Q_STR || removes[0] != '\0';
+        bool is_str = re->type == Q_STR;
         q_release_element(re);
 
         removes[string_length + STRINGPAD] = '\0';
-        if (removes[0] == '\0') {
+        if (!stored) {
             report(1, "ERROR: Failed to store removed value");
             ok = false;
         }
@@ -378,9 +955,12 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
                    "destination buffer.");
             ok = false;
         } else {
-            report(2, "Removed %s from queue", removes);
+            report(2, "Removed %s from queue", is_str ? removes : vbuf);
         }
         current->size--;
+        if (!journal_note(current,
+                          pos == POS_TAIL ? J_REMOVE_TAIL : J_REMOVE_HEAD, 0))
+            ok = false;
     } else {
         fail_count++;
         if (!check && fail_count < fail_limit) {
@@ -392,7 +972,7 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         }
     }
 
-    if (ok && check && strcmp(removes, checks)) {
+    if (ok && check && elem_type == Q_STR && strcmp(removes, checks)) {
         report(1, "ERROR: Removed value %s != expected value %s", removes,
                checks);
         ok = false;
@@ -400,6 +980,7 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
 
     q_show(3);
 
+    free(blob_buf);
     free(removes);
     free(checks);
     return ok && !error_check();
@@ -429,27 +1010,32 @@ static bool do_dedup(int argc, char *argv[])
 
     LIST_HEAD(l_copy);
     element_t *item = NULL, *tmp = NULL;
+    struct list_head *ahead;
 
     // Copy current->q to l_copy
     if (current->q && !list_empty(current->q)) {
-        list_for_each_entry (item, current->q, list) {
-            size_t slen;
+        list_for_each_entry_prefetch (item, ahead, current->q, list) {
+            if (ahead != current->q)
+                list_prefetch(list_entry(ahead, element_t, list)->value);
             tmp = malloc(sizeof(element_t));
             if (!tmp)
                 break;
+            *tmp = *item;
             INIT_LIST_HEAD(&tmp->list);
-            slen = strlen(item->value) + 1;
-            tmp->value = malloc(slen);
-            if (!tmp->value) {
-                free(tmp);
-                break;
+            if (item->value) {
+                tmp->value = malloc(item->len + 1);
+                if (!tmp->value) {
+                    free(tmp);
+                    break;
+                }
+                memcpy(tmp->value, item->value, item->len + 1);
             }
-            memcpy(tmp->value, item->value, slen);
             list_add_tail(&tmp->list, &l_copy);
         }
         // Return false if the loop does not leave properly
         if (&item->list != current->q) {
-            list_for_each_entry_safe (item, tmp, &l_copy, list) {
+            list_for_each_entry_safe_prefetch (item, tmp, ahead, &l_copy,
+                                               list) {
                 free(item->value);
                 free(item);
             }
@@ -464,9 +1050,10 @@ static bool do_dedup(int argc, char *argv[])
     if (exception_setup(true))
         ok = q_delete_dup(current->q);
     exception_cancel();
+    ok = ok && journal_note(current, J_DELETE_DUP, 0);
 
     if (!ok) {
-        list_for_each_entry_safe (item, tmp, &l_copy, list) {
+        list_for_each_entry_safe_prefetch (item, tmp, ahead, &l_copy, list) {
             free(item->value);
             free(item);
         }
@@ -481,14 +1068,13 @@ static bool do_dedup(int argc, char *argv[])
         // Skip comparison with new list if the string is duplicate
         bool is_next_dup =
             item->list.next != &l_copy &&
-            strcmp(list_entry(item->list.next, element_t, list)->value,
-                   item->value) == 0;
+            q_element_equal(list_entry(item->list.next, element_t, list),
+                            item);
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
         } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
+                   q_element_equal(list_entry(l_tmp, element_t, list), item))
             l_tmp = l_tmp->next;
         else
             ok = false;
@@ -501,7 +1087,7 @@ static bool do_dedup(int argc, char *argv[])
                "ERROR: Duplicate strings are in queue or distinct strings are "
                "not in queue");
 
-    list_for_each_entry_safe (item, tmp, &l_copy, list) {
+    list_for_each_entry_safe_prefetch (item, tmp, ahead, &l_copy, list) {
         free(item->value);
         free(item);
     }
@@ -521,14 +1107,18 @@ static bool do_reverse(int argc, char *argv[])
         report(3, "Warning: Calling reverse on null queue");
     error_check();
 
+    bool done = false;
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
+    if (current && exception_setup(true)) {
         q_reverse(current->q);
+        done = true;
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
+    bool ok = !done || journal_note(current, J_REVERSE, 0);
     q_show(3);
-    return !error_check();
+    return ok && !error_check();
 }
 
 static bool do_size(int argc, char *argv[])
@@ -591,14 +1181,42 @@ bool do_shuffle(int argc, char *argv[])
         report(3, "Warning: Calling reverse on null queue");
     error_check();
 
+    bool done = false;
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
+    if (current && exception_setup(true)) {
         q_shuffle(current->q);
+        done = true;
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
+    bool ok = !done || journal_snapshot(current);
     q_show(3);
-    return !error_check();
+    return ok && !error_check();
+}
+
+/* Check that the first cnt elements of q are in the order of option
+ * descend.
+ */
+static bool check_sorted(struct list_head *q, int cnt)
+{
+    for (struct list_head *cur_l = q->next; cur_l != q && --cnt > 0;
+         cur_l = cur_l->next) {
+        /* Ensure each element in ascending/descending order */
+        element_t *item, *next_item;
+        item = list_entry(cur_l, element_t, list);
+        next_item = list_entry(cur_l->next, element_t, list);
+        if (!descend && q_element_cmp(item, next_item) > 0) {
+            report(1, "ERROR: Not sorted in ascending order");
+            return false;
+        }
+
+        if (descend && q_element_cmp(item, next_item) < 0) {
+            report(1, "ERROR: Not sorted in descending order");
+            return false;
+        }
+    }
+    return true;
 }
 
 bool do_sort(int argc, char *argv[])
@@ -619,33 +1237,131 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    bool done = false;
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
+    if (current && exception_setup(true)) {
         q_sort(current->q, descend);
+        done = true;
+    }
     exception_cancel();
     set_noallocate_mode(false);
 
-    bool ok = true;
-    if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            /* Ensure each element in ascending/descending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
-                ok = false;
-                break;
-            }
+    bool ok = !done || journal_note(current, J_SORT, descend);
+    if (ok && current && current->size)
+        ok = check_sorted(current->q, cnt);
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
-                report(1, "ERROR: Not sorted in descending order");
-                ok = false;
-                break;
-            }
+    q_show(3);
+    return ok && !error_check();
+}
+
+typedef struct {
+    queue_contex_t *ctx;
+    bool descend;
+    bool done;
+    bool ok;
+} psort_job_t;
+
+/* Kept out of line, like the queue operations run by commands, so that an
+ * exception returns to psort_job() past the call
+ */
+static void __attribute__((noinline)) psort_run(psort_job_t *job)
+{
+    q_sort(job->ctx->q, job->descend);
+    job->done = true;
+}
+
+/* Job of the calling worker, which unlike a local survives an exception */
+static _Thread_local psort_job_t *psort_self;
+
+static void psort_job(void *arg)
+{
+    psort_self = arg;
+    set_worker_mode(true);
+    error_check();
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        psort_run(psort_self);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    psort_job_t *job = psort_self;
+    job->ok = !error_check() && job->done;
+}
+
+/* Return *p, restarted first if it does not have nthreads workers */
+static tpool_t *resize_pool(tpool_t **p, int nthreads)
+{
+    if (*p && tpool_size(*p) != nthreads) {
+        tpool_free(*p);
+        *p = NULL;
+    }
+    if (!*p)
+        *p = tpool_new(nthreads);
+    return *p;
+}
+
+/* Pool of worker threads for parallel commands, sized by option threads */
+static tpool_t *get_pool()
+{
+    return resize_pool(&pool, pool_threads);
+}
+
+static bool do_psort(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!chain.size) {
+        report(3, "Warning: Calling psort with no queue");
+        return true;
+    }
+
+    tpool_t *p = get_pool();
+    if (!p) {
+        report(1, "ERROR: Could not start %d worker threads", pool_threads);
+        return false;
+    }
+
+    psort_job_t *jobs = calloc(chain.size, sizeof(psort_job_t));
+    if (!jobs) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for jobs");
+        return false;
+    }
+    error_check();
+
+    /* Each worker has its own time limit, so the waiting thread has none */
+    int n = 0;
+    struct list_head *cur;
+    list_for_each (cur, &chain.head) {
+        jobs[n].ctx = list_entry(cur, queue_contex_t, chain);
+        jobs[n].descend = descend;
+        if (!tpool_submit(p, psort_job, &jobs[n])) {
+            report(1, "ERROR: Could not schedule sort on queue %d",
+                   jobs[n].ctx->id);
+            jobs[n].ctx = NULL;
+        }
+        n++;
+    }
+    tpool_wait(p);
+
+    bool ok = true;
+    for (int i = 0; i < n; i++) {
+        queue_contex_t *ctx = jobs[i].ctx;
+        if (!ctx) {
+            ok = false;
+            continue;
+        }
+        if (!jobs[i].ok) {
+            report(1, "Queue %d: sort failed", ctx->id);
+            ok = false;
         }
+        if (jobs[i].done)
+            ok = journal_note(ctx, J_SORT, descend) &&
+                 check_sorted(ctx->q, ctx->size) && ok;
     }
+    free(jobs);
 
     q_show(3);
     return ok && !error_check();
@@ -668,6 +1384,7 @@ static bool do_dm(int argc, char *argv[])
     if (exception_setup(true))
         ok = q_delete_mid(current->q);
     exception_cancel();
+    ok = ok && journal_note(current, J_DELETE_MID, 0);
 
     if (!current->size)
         report(3, "Warning: Try to delete middle node to empty queue");
@@ -690,15 +1407,19 @@ static bool do_swap(int argc, char *argv[])
     }
     error_check();
 
+    bool ok = false;
     set_noallocate_mode(true);
-    if (exception_setup(true))
+    if (exception_setup(true)) {
         q_swap(current->q);
+        ok = true;
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
+    ok = ok && journal_note(current, J_SWAP, 0);
 
     q_show(3);
-    return !error_check();
+    return ok && !error_check();
 }
 
 
@@ -723,11 +1444,14 @@ static bool do_ascend(int argc, char *argv[])
         report(3, "Warning: Calling ascend on single node");
     error_check();
 
-    if (exception_setup(true))
+    bool ok = false;
+    if (exception_setup(true)) {
         current->size = q_ascend(current->q);
+        ok = true;
+    }
     set_noallocate_mode(false);
 
-    bool ok = true;
+    ok = ok && journal_note(current, J_ASCEND, 0);
 
     cnt = current->size;
     if (current->size) {
@@ -736,7 +1460,7 @@ static bool do_ascend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
+            if (q_element_cmp(item, next_item) > 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -770,11 +1494,14 @@ static bool do_descend(int argc, char *argv[])
         report(3, "Warning: Calling descend on single node");
     error_check();
 
-    if (exception_setup(true))
+    bool ok = false;
+    if (exception_setup(true)) {
         current->size = q_descend(current->q);
+        ok = true;
+    }
     set_noallocate_mode(false);
 
-    bool ok = true;
+    ok = ok && journal_note(current, J_DESCEND, 0);
 
     cnt = current->size;
     if (current->size) {
@@ -783,7 +1510,7 @@ static bool do_descend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
+            if (q_element_cmp(item, next_item) < 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -816,14 +1543,18 @@ static bool do_reverseK(int argc, char *argv[])
         return false;
     }
 
+    bool ok = false;
     set_noallocate_mode(true);
-    if (exception_setup(true))
+    if (exception_setup(true)) {
         q_reverseK(current->q, k);
+        ok = true;
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
+    ok = ok && journal_note(current, J_REVERSE_K, k);
     q_show(3);
-    return !error_check();
+    return ok && !error_check();
 }
 
 static bool do_merge(int argc, char *argv[])
@@ -839,13 +1570,33 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
+    tpool_t *p = NULL;
+    if (merge_threads > 0 && !(p = resize_pool(&merge_pool, merge_threads))) {
+        report(1, "ERROR: Could not start %d worker threads", merge_threads);
+        return false;
+    }
+
     int len = 0;
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        len = q_merge(&chain.head, descend);
+    /* The time limit cannot unwind a wait on workers */
+    if (current && exception_setup(!p))
+        len = p ? q_merge_parallel(&chain.head, descend, p)
+                : q_merge(&chain.head, descend);
     exception_cancel();
     set_noallocate_mode(false);
 
+    /* Records cannot describe a merge, so the journal takes a snapshot of
+     * the merged queue or stops if its queue is merged into another.
+     */
+    bool ok = true;
+    if (journal && journaled == list_first_entry(&chain.head, queue_contex_t,
+                                                 chain)) {
+        ok = journal_snapshot(journaled);
+    } else if (journal) {
+        report(3, "Closing the journal of a queue merged into another");
+        ok = journal_stop();
+    }
+
     if (q_size(&chain.head) > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
@@ -863,7 +1614,6 @@ static bool do_merge(int argc, char *argv[])
         current->chain.next = &chain.head;
     }
 
-    bool ok = true;
     if (current && current->size) {
         for (struct list_head *cur_l = current->q->next;
              cur_l != current->q && --len; cur_l = cur_l->next) {
@@ -871,7 +1621,7 @@ static bool do_merge(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && q_element_cmp(item, next_item) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
                        "of unsorted queues are merged or there're some flaws "
@@ -881,7 +1631,7 @@ static bool do_merge(int argc, char *argv[])
             }
 
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && q_element_cmp(item, next_item) < 0) {
                 report(
                     1,
                     "ERROR: Not sorted in descending order (It might because "
@@ -941,8 +1691,10 @@ static bool q_show(int vlevel)
         while (ok && ori != cur && cnt < current->size) {
             element_t *e = list_entry(cur, element_t, list);
             if (cnt < BIG_LIST_SIZE) {
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
-                if (show_entropy) {
+                char vbuf[MAXSTRING + 1];
+                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s",
+                                format_value(e, vbuf, sizeof(vbuf)));
+                if (show_entropy && e->type == Q_STR) {
                     report_noreturn(
                         vlevel, "(%3.2f%%)",
                         shannon_entropy((const uint8_t *) e->value));
@@ -1034,64 +1786,1300 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 extern int start(int, char **);
-bool do_ttt(int argc, char *argv[])
+/* Allocate an unlinked element holding the value of the probe element e */
+static element_t *new_value(const element_t *e)
 {
-    if (argc > 1)
-        ttt_game_mode = atoi(argv[1]);
-    start(argc, argv);
+    if (e->type == Q_INT)
+        return q_element_new_int(q_element_int(e));
+    return q_element_new(e->type, e->value, e->len);
+}
+
+static bool do_pqpush(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    char vbuf[MAXSTRING + 1];
+    int reps = 1;
+    bool ok = true, need_rand = false;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    if (argc == 3 && !get_int(argv[2], &reps)) {
+        report(1, "Invalid number of insertions '%s'", argv[2]);
+        return false;
+    }
+
+    element_t probe;
+    char *blob_buf = malloc(strlen(inserts) + 1);
+    if (!blob_buf) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for value");
+        return false;
+    }
+    if (!strcmp(inserts, "RAND")) {
+        need_rand = true;
+    } else if (!parse_value(inserts, &probe, blob_buf)) {
+        report(1, "Invalid %s value '%s'", elem_type_names[elem_type],
+               inserts);
+        free(blob_buf);
+        return false;
+    }
+    error_check();
+
+    if (exception_setup(true)) {
+        for (int r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_value(&probe, randstr_buf, sizeof(randstr_buf));
+            element_t *e = new_value(&probe);
+            if (e && !pq_push(&pq, e)) {
+                q_release_element(e);
+                e = NULL;
+            }
+            if (!e) {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed",
+                           format_value(&probe, vbuf, sizeof(vbuf)));
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           format_value(&probe, vbuf, sizeof(vbuf)),
+                           fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+    free(blob_buf);
+
+    report(3, "Priority queue holds %zu elements", pq.size);
+    return ok;
+}
+
+static bool pq_remove(bool max, int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    element_t probe;
+    char *blob_buf = NULL;
+    bool check = argc > 1;
+    if (check) {
+        blob_buf = malloc(strlen(argv[1]) + 1);
+        if (!blob_buf || !parse_value(argv[1], &probe, blob_buf)) {
+            report(1, "Invalid %s value '%s'", elem_type_names[elem_type],
+                   argv[1]);
+            free(blob_buf);
+            return false;
+        }
+    }
+
+    if (!pq.size)
+        report(3, "Warning: Calling %s on empty priority queue", argv[0]);
+    error_check();
+
+    element_t *re = NULL;
+    if (exception_setup(true))
+        re = max ? q_pop_max(&pq) : q_pop_min(&pq);
+    exception_cancel();
+
+    bool ok = true;
+    char vbuf[MAXSTRING + 1];
+    if (re) {
+        const char *value = format_value(re, vbuf, sizeof(vbuf));
+        if (check && !q_element_equal(re, &probe)) {
+            report(1, "ERROR: Removed value %s != expected value %s", value,
+                   argv[1]);
+            ok = false;
+        }
+
+        /* The new end must not come before the removed element */
+        const element_t *end = max ? pq_peek_max(&pq) : pq_peek_min(&pq);
+        if (end) {
+            int c = q_element_cmp(re, end);
+            if (max ? c < 0 : c > 0) {
+                report(1, "ERROR: Removed value %s is not the %s", value,
+                       max ? "maximum" : "minimum");
+                ok = false;
+            }
+        }
+        report(2, "Removed %s from priority queue", value);
+        q_release_element(re);
+    } else {
+        fail_count++;
+        if (!check && fail_count < fail_limit) {
+            report(2, "Removal from priority queue failed");
+        } else {
+            report(1,
+                   "ERROR: Removal from priority queue failed (%d failures "
+                   "total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+
+    free(blob_buf);
+    return ok && !error_check();
+}
+
+static bool do_pqmin(int argc, char *argv[])
+{
+    return pq_remove(false, argc, argv);
+}
+
+static bool do_pqmax(int argc, char *argv[])
+{
+    return pq_remove(true, argc, argv);
+}
+
+static bool do_pqload(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling pqload on null queue");
+        return false;
+    }
+    error_check();
+
+    bool moved = false;
+    if (exception_setup(true))
+        moved = pq_from_queue(&pq, current->q);
+    exception_cancel();
+
+    if (!moved) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Moving queue into priority queue failed");
+            return !error_check();
+        }
+        report(1,
+               "ERROR: Moving queue into priority queue failed (%d failures "
+               "total)",
+               fail_count);
+        return false;
+    }
+
+    bool ok = true;
+    if (!list_empty(current->q)) {
+        report(1, "ERROR: Queue is not empty after moving it");
+        ok = false;
+    }
+    current->size = 0;
+    ok = journal_snapshot(current) && ok;
+    report(3, "Priority queue holds %zu elements", pq.size);
+    q_show(3);
+
+    return ok && !error_check();
+}
+
+static bool do_pqsize(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    report(1, "Priority queue size = %zu", pq.size);
     return true;
 }
 
-static void console_init()
+static bool do_pqfree(int argc, char *argv[])
 {
-    ADD_COMMAND(new, "Create new queue", "");
-    ADD_COMMAND(free, "Delete queue", "");
-    ADD_COMMAND(prev, "Switch to previous queue", "");
-    ADD_COMMAND(next, "Switch to next queue", "");
-    ADD_COMMAND(ih,
-                "Insert string str at head of queue n times. Generate random "
-                "string(s) if str equals RAND. (default: n == 1)",
-                "str [n]");
-    ADD_COMMAND(it,
-                "Insert string str at tail of queue n times. Generate random "
-                "string(s) if str equals RAND. (default: n == 1)",
-                "str [n]");
-    ADD_COMMAND(
-        rh,
-        "Remove from head of queue. Optionally compare to expected value str",
-        "[str]");
-    ADD_COMMAND(
-        rt,
-        "Remove from tail of queue. Optionally compare to expected value str",
-        "[str]");
-    ADD_COMMAND(reverse, "Reverse queue", "");
-    ADD_COMMAND(shuffle, "Do Fisher-Yates shuffle", "");
-    ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
-    ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
-    ADD_COMMAND(show, "Show queue contents", "");
-    ADD_COMMAND(dm, "Delete middle node in queue", "");
-    ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
-    ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
-    ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
-    ADD_COMMAND(ascend,
-                "Remove every node which has a node with a strictly less "
-                "value anywhere to the right side of it",
-                "");
-    ADD_COMMAND(descend,
-                "Remove every node which has a node with a strictly greater "
-                "value anywhere to the right side of it",
-                "");
-    ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
-                "[K]");
-    ADD_COMMAND(ttt, "Start ttt game", "");
-    add_param("length", &string_length, "Maximum length of displayed string",
-              NULL);
-    add_param("malloc", &fail_probability, "Malloc failure probability percent",
-              NULL);
-    add_param("fail", &fail_limit,
-              "Number of times allow queue operations to return false", NULL);
-    add_param("descend", &descend,
-              "Sort and merge queue in ascending/descending order", NULL);
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    error_check();
+
+    if (exception_setup(true))
+        pq_free(&pq);
+    exception_cancel();
+
+    return !error_check();
+}
+
+static bool do_jopen(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Calling jopen on null queue");
+        return false;
+    }
+    if (journal) {
+        report(1, "ERROR: Queue %d is already journaled", journaled->id);
+        return false;
+    }
+    error_check();
+
+    if (exception_setup(true))
+        journal = journal_open(
+            argv[1], current->q, journal_group,
+            journal_compact_kb > 0 ? (size_t) journal_compact_kb * 1024 : 0);
+    exception_cancel();
+    if (!journal) {
+        report(1,
+               "ERROR: Could not open journal %s, which can only be "
+               "recovered into an empty queue",
+               argv[1]);
+        return false;
+    }
+
+    journaled = current;
+    current->size = q_size(current->q);
+    journal_stats_t st = journal_stats(journal);
+    report(2, "Journaling queue %d to %s, recovered %d elements from %" PRIu64
+              " records",
+           current->id, argv[1], current->size, st.replayed);
+    q_show(3);
+    return !error_check();
+}
+
+static bool do_jclose(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!journal) {
+        report(3, "Warning: No queue is journaled");
+        return false;
+    }
+    return journal_stop();
+}
+
+static bool do_jdrop(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (journal && !journal_stop())
+        return false;
+    if (!journal_unlink(argv[1])) {
+        report(1, "ERROR: %s is not a journal", argv[1]);
+        return false;
+    }
+    return true;
+}
+
+static bool do_jsync(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!journal) {
+        report(3, "Warning: No queue is journaled");
+        return false;
+    }
+    if (!journal_sync(journal)) {
+        report(1, "ERROR: Could not sync journal");
+        return false;
+    }
+    return true;
+}
+
+static bool do_jcompact(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!journal) {
+        report(3, "Warning: No queue is journaled");
+        return false;
+    }
+    return journal_snapshot(journaled);
+}
+
+static bool do_jstat(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!journal) {
+        report(3, "Warning: No queue is journaled");
+        return false;
+    }
+    journal_stats_t st = journal_stats(journal);
+    report(1,
+           "Journal of queue %d: %" PRIu64 " records, %" PRIu64
+           " bytes, %" PRIu64 " syncs, %" PRIu64 " compactions",
+           journaled->id, st.records, st.bytes, st.syncs, st.compactions);
+    report(2, "Journaling overhead: %.0f ns per record",
+           st.records ? (double) st.ns / st.records : 0.0);
+    return true;
+}
+
+/* Turn a command argument into a shm_open() name, which starts with '/' */
+static bool shm_name(const char *arg, char *buf, size_t size)
+{
+    int n = snprintf(buf, size, "%s%s", arg[0] == '/' ? "" : "/", arg);
+    return n > 1 && (size_t) n < size && !strchr(buf + 1, '/');
+}
+
+static bool do_shmcreate(int argc, char *argv[])
+{
+    char name[MAXSTRING + 2];
+    int size = SHMQ_DEFAULT_SIZE;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (!shm_name(argv[1], name, sizeof(name))) {
+        report(1, "Invalid shared queue name '%s'", argv[1]);
+        return false;
+    }
+    if (argc == 3 && (!get_int(argv[2], &size) || size <= 0)) {
+        report(1, "Invalid segment size '%s'", argv[2]);
+        return false;
+    }
+    if (shm) {
+        report(1, "ERROR: Already attached to a shared queue");
+        return false;
+    }
+
+    shm = shmq_create(name, size);
+    if (!shm) {
+        report(1, "ERROR: Could not create shared queue %s of %d bytes",
+               name, size);
+        return false;
+    }
+    strcpy(shm_owned, name);
+    report(2, "Created shared queue %s", name);
+    return true;
+}
+
+static bool do_shmattach(int argc, char *argv[])
+{
+    char name[MAXSTRING + 2];
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!shm_name(argv[1], name, sizeof(name))) {
+        report(1, "Invalid shared queue name '%s'", argv[1]);
+        return false;
+    }
+    if (shm) {
+        report(1, "ERROR: Already attached to a shared queue");
+        return false;
+    }
+
+    shm = shmq_attach(name);
+    if (!shm) {
+        report(1, "ERROR: Could not attach to shared queue %s", name);
+        return false;
+    }
+    shm_owned[0] = '\0';
+    report(2, "Attached to shared queue %s holding %zu strings", name,
+           shmq_size(shm));
+    return true;
+}
+
+/* Unmap the shared queue, removing its name if this process created it */
+static void shm_release()
+{
+    shmq_detach(shm);
+    shm = NULL;
+    if (shm_owned[0]) {
+        shmq_unlink(shm_owned);
+        shm_owned[0] = '\0';
+    }
+}
+
+static bool do_shmdetach(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!shm) {
+        report(3, "Warning: Not attached to a shared queue");
+        return false;
+    }
+    shm_release();
+    return true;
+}
+
+static bool do_shmit(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    int reps = 1;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 3 && !get_int(argv[2], &reps)) {
+        report(1, "Invalid number of insertions '%s'", argv[2]);
+        return false;
+    }
+    if (!shm) {
+        report(3, "Warning: Not attached to a shared queue");
+        return false;
+    }
+
+    bool need_rand = !strcmp(argv[1], "RAND");
+    const char *inserts = need_rand ? randstr_buf : argv[1];
+    for (int r = 0; r < reps; r++) {
+        if (need_rand)
+            fill_rand_string(randstr_buf, sizeof(randstr_buf));
+        if (!shmq_try_insert_tail(shm, inserts)) {
+            report(1, "ERROR: Shared queue is full after %d insertions", r);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool do_shmrh(int argc, char *argv[])
+{
+    char value[MAXSTRING + 1];
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (!shm) {
+        report(3, "Warning: Not attached to a shared queue");
+        return false;
+    }
+
+    if (!shmq_try_remove_head(shm, value, sizeof(value))) {
+        report(1, "ERROR: Shared queue is empty");
+        return false;
+    }
+    if (argc == 2 && strcmp(argv[1], value)) {
+        report(1, "ERROR: Removed value %s != expected value %s", value,
+               argv[1]);
+        return false;
+    }
+    report(2, "Removed %s from shared queue", value);
+    return true;
+}
+
+static bool do_shmsize(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!shm) {
+        report(3, "Warning: Not attached to a shared queue");
+        return false;
+    }
+    report(1, "Shared queue size = %zu", shmq_size(shm));
+    return true;
+}
+
+static bool cq_insert(bool tail, int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    char vbuf[MAXSTRING + 1];
+    int reps = 1;
+    bool ok = true, need_rand = false;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    if (argc == 3 && !get_int(argv[2], &reps)) {
+        report(1, "Invalid number of insertions '%s'", argv[2]);
+        return false;
+    }
+
+    element_t probe;
+    char *blob_buf = malloc(strlen(inserts) + 1);
+    if (!blob_buf) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for value");
+        return false;
+    }
+    if (!strcmp(inserts, "RAND")) {
+        need_rand = true;
+    } else if (!parse_value(inserts, &probe, blob_buf)) {
+        report(1, "Invalid %s value '%s'", elem_type_names[elem_type],
+               inserts);
+        free(blob_buf);
+        return false;
+    }
+    error_check();
+
+    if (exception_setup(true)) {
+        if (!cq)
+            cq = cq_new(elem_type);
+        for (int r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_value(&probe, randstr_buf, sizeof(randstr_buf));
+            if (!(tail ? cq_insert_tail(cq, &probe)
+                       : cq_insert_head(cq, &probe))) {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed",
+                           format_value(&probe, vbuf, sizeof(vbuf)));
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           format_value(&probe, vbuf, sizeof(vbuf)),
+                           fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+    free(blob_buf);
+
+    report(3, "Compact queue holds %zu elements", cq ? cq_size(cq) : 0);
+    return ok;
+}
+
+static bool do_cqih(int argc, char *argv[])
+{
+    return cq_insert(false, argc, argv);
+}
+
+static bool do_cqit(int argc, char *argv[])
+{
+    return cq_insert(true, argc, argv);
+}
+
+static bool cq_remove(bool tail, int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    element_t probe;
+    char *blob_buf = NULL;
+    bool check = argc > 1;
+    if (check) {
+        blob_buf = malloc(strlen(argv[1]) + 1);
+        if (!blob_buf || !parse_value(argv[1], &probe, blob_buf)) {
+            report(1, "Invalid %s value '%s'", elem_type_names[elem_type],
+                   argv[1]);
+            free(blob_buf);
+            return false;
+        }
+    }
+
+    if (!cq || !cq_size(cq))
+        report(3, "Warning: Calling %s on empty compact queue", argv[0]);
+    error_check();
+
+    bool ok = false;
+    element_t re;
+    char buf[MAXSTRING + 1], vbuf[MAXSTRING + 1];
+    if (exception_setup(true))
+        ok = tail ? cq_remove_tail(cq, &re, buf, sizeof(buf))
+                  : cq_remove_head(cq, &re, buf, sizeof(buf));
+    exception_cancel();
+
+    if (ok) {
+        const char *value = format_value(&re, vbuf, sizeof(vbuf));
+        if (check && !q_element_equal(&re, &probe)) {
+            report(1, "ERROR: Removed value %s != expected value %s", value,
+                   argv[1]);
+            ok = false;
+        }
+        report(2, "Removed %s from compact queue", value);
+    } else {
+        fail_count++;
+        if (!check && fail_count < fail_limit) {
+            report(2, "Removal from compact queue failed");
+            ok = true;
+        } else {
+            report(1,
+                   "ERROR: Removal from compact queue failed (%d failures "
+                   "total)",
+                   fail_count);
+        }
+    }
+
+    free(blob_buf);
+    return ok && !error_check();
+}
+
+static bool do_cqrh(int argc, char *argv[])
+{
+    return cq_remove(false, argc, argv);
+}
+
+static bool do_cqrt(int argc, char *argv[])
+{
+    return cq_remove(true, argc, argv);
+}
+
+static bool do_cqload(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling cqload on null queue");
+        return false;
+    }
+    error_check();
+
+    cqueue_t *copy = NULL;
+    if (exception_setup(true))
+        copy = cq_from_queue(current->q, elem_type);
+    exception_cancel();
+    if (!copy) {
+        report(1, "ERROR: Could not copy queue into compact queue");
+        return false;
+    }
+    cq_free(cq);
+    cq = copy;
+
+    bool ok = cq_size(cq) == (size_t) current->size;
+    if (!ok)
+        report(1, "ERROR: Compact queue does not have the size of the queue");
+    report(3, "Compact queue holds %zu elements", cq_size(cq));
+    return ok && !error_check();
+}
+
+static bool do_cqstore(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!cq) {
+        report(3, "Warning: There is no compact queue");
+        return false;
+    }
+    error_check();
+
+    struct list_head *q = q_new();
+    bool ok = false;
+    if (q && exception_setup(true))
+        ok = cq_to_queue(cq, q);
+    exception_cancel();
+    if (!ok) {
+        report(1, "ERROR: Could not copy compact queue");
+        q_free(q);
+        return false;
+    }
+
+    queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+    list_add_tail(&qctx->chain, &chain.head);
+    qctx->size = cq_size(cq);
+    qctx->q = q;
+    qctx->id = chain.size++;
+    current = qctx;
+
+    q_show(3);
+    return !error_check();
+}
+
+static bool do_cqop(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    int k = 0;
+    bool reverse_k = !strcmp(argv[1], "reverseK");
+    if (reverse_k && (argc != 3 || !get_int(argv[2], &k) || k < 1)) {
+        report(1, "reverseK needs a positive group size");
+        return false;
+    }
+
+    if (!cq) {
+        report(3, "Warning: There is no compact queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true, known = true;
+    if (exception_setup(true)) {
+        if (reverse_k)
+            cq_reverseK(cq, k);
+        else if (!strcmp(argv[1], "reverse"))
+            cq_reverse(cq);
+        else if (!strcmp(argv[1], "swap"))
+            cq_swap(cq);
+        else if (!strcmp(argv[1], "sort"))
+            cq_sort(cq, descend);
+        else if (!strcmp(argv[1], "dedup"))
+            cq_delete_dup(cq);
+        else if (!strcmp(argv[1], "dm"))
+            ok = cq_delete_mid(cq);
+        else if (!strcmp(argv[1], "ascend"))
+            cq_ascend(cq);
+        else if (!strcmp(argv[1], "descend"))
+            cq_descend(cq);
+        else
+            known = false;
+    }
+    exception_cancel();
+
+    if (!known) {
+        report(1, "Unknown compact queue operation '%s'", argv[1]);
+        return false;
+    }
+    if (!ok)
+        report(1, "ERROR: Calling %s on empty compact queue", argv[1]);
+    report(3, "Compact queue holds %zu elements", cq_size(cq));
+    return ok && !error_check();
+}
+
+static bool do_cqsize(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    size_t n = cq ? cq_size(cq) : 0;
+    report(1, "Compact queue size = %zu", n);
+    if (cq)
+        report(2, "Compact queue memory: %zu bytes, %.1f per element",
+               cq_bytes(cq), n ? (double) cq_bytes(cq) / n : 0.0);
+    return true;
+}
+
+static bool do_cqfree(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    cq_free(cq);
+    cq = NULL;
+    return true;
+}
+
+/* Commands that only touch the current queue and may run on every queue
+ * of the chain at once.
+ */
+static const struct {
+    const char *name;
+    cmd_func_t op;
+} parallel_cmds[] = {
+    {"ih", do_ih},           {"it", do_it},
+    {"rh", do_rh},           {"rt", do_rt},
+    {"reverse", do_reverse}, {"shuffle", do_shuffle},
+    {"sort", do_sort},       {"size", do_size},
+    {"dm", do_dm},           {"dedup", do_dedup},
+    {"swap", do_swap},       {"ascend", do_ascend},
+    {"descend", do_descend}, {"reverseK", do_reverseK},
+};
+
+typedef struct {
+    queue_contex_t *ctx;
+    cmd_func_t op;
+    int argc;
+    char **argv;
+    bool ok;
+    double seconds;
+} parallel_job_t;
+
+static void parallel_job(void *arg)
+{
+    parallel_job_t *job = arg;
+    double start;
+
+    set_worker_mode(true);
+    current = job->ctx;
+    error_check();
+    init_time(&start);
+    job->ok = job->op(job->argc, job->argv);
+    job->ok = !error_check() && job->ok;
+    job->seconds = delta_time(&start);
+    current = NULL;
+}
+
+static bool do_parallel(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs a command", argv[0]);
+        return false;
+    }
+
+    cmd_func_t op = NULL;
+    for (size_t i = 0; i < sizeof(parallel_cmds) / sizeof(parallel_cmds[0]);
+         i++) {
+        if (!strcmp(argv[1], parallel_cmds[i].name))
+            op = parallel_cmds[i].op;
+    }
+    if (!op) {
+        report(1, "ERROR: Command '%s' cannot run in parallel", argv[1]);
+        return false;
+    }
+    if (simulation) {
+        report(1, "ERROR: Cannot run in parallel in simulation mode");
+        return false;
+    }
+    if (!chain.size) {
+        report(3, "Warning: Calling parallel with no queue");
+        return true;
+    }
+
+    tpool_t *p = get_pool();
+    if (!p) {
+        report(1, "ERROR: Could not start %d worker threads", pool_threads);
+        return false;
+    }
+
+    parallel_job_t *jobs = calloc(chain.size, sizeof(parallel_job_t));
+    if (!jobs) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for jobs");
+        return false;
+    }
+
+    double start;
+    init_time(&start);
+    int n = 0;
+    struct list_head *cur;
+    list_for_each (cur, &chain.head) {
+        jobs[n].ctx = list_entry(cur, queue_contex_t, chain);
+        jobs[n].op = op;
+        jobs[n].argc = argc - 1;
+        jobs[n].argv = argv + 1;
+        if (!tpool_submit(p, parallel_job, &jobs[n])) {
+            report(1, "ERROR: Could not schedule %s on queue %d", argv[1],
+                   jobs[n].ctx->id);
+            jobs[n].ctx = NULL;
+        }
+        n++;
+    }
+    tpool_wait(p);
+    double wall = delta_time(&start);
+
+    bool ok = true;
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        if (!jobs[i].ctx) {
+            ok = false;
+            continue;
+        }
+        report(1, "Queue %d: %s %s in %.3f s", jobs[i].ctx->id, argv[1],
+               jobs[i].ok ? "done" : "failed", jobs[i].seconds);
+        ok = ok && jobs[i].ok;
+        total += jobs[i].seconds;
+    }
+    report(1, "%s on %d queues: %.3f s wall, %.3f s total", argv[1], n, wall,
+           total);
+    free(jobs);
+
+    return ok && !error_check();
+}
+
+/* Strings each thread of stress inserts and removes by default */
+#define STRESS_OPS 10000
+
+typedef struct {
+    mpmc_t *q;
+    int id, ops;
+    atomic_int *running;
+    long inserted, removed;
+    bool ok;
+} stress_job_t;
+
+/* Insert a string and remove one, ops times.  The time limit only
+ * interrupts the thread between two rounds: unwinding one half done could
+ * free a node other threads still use, or leave a lock of the C library
+ * held.  Kept out of line, like the queue operations run by commands, so
+ * that an exception returns to stress_job() past the call.
+ */
+static void __attribute__((noinline)) stress_run(stress_job_t *job)
+{
+    char buf[32];
+    sigset_t alrm, old;
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
+
+    for (int i = 0; i < job->ops; i++) {
+        pthread_sigmask(SIG_BLOCK, &alrm, &old);
+        snprintf(buf, sizeof(buf), "%d:%d", job->id, i);
+        job->inserted += mpmc_insert_tail(job->q, buf);
+        if (mpmc_remove_head(job->q, buf, sizeof(buf))) {
+            int id, seq;
+            job->removed++;
+            if (sscanf(buf, "%d:%d", &id, &seq) != 2 || id < 0 || seq < 0) {
+                report(1, "ERROR: Thread %d removed unexpected string '%s'",
+                       job->id, buf);
+                job->ok = false;
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+}
+
+/* Job of the calling thread, which unlike a local survives an exception */
+static _Thread_local stress_job_t *stress_self;
+
+/* Every thread waits for the others before it exits: once no thread
+ * guards a node, each frees every node it retired when it exits.
+ */
+static void *stress_job(void *arg)
+{
+    stress_self = arg;
+    set_worker_mode(true);
+    error_check();
+    stress_self->ok = true;
+    if (exception_setup(true))
+        stress_run(stress_self);
+    exception_cancel();
+
+    stress_job_t *job = stress_self;
+    job->ok = !error_check() && job->ok;
+
+    atomic_fetch_sub(job->running, 1);
+    while (atomic_load(job->running))
+        sched_yield();
+    return NULL;
+}
+
+static bool do_stress(int argc, char *argv[])
+{
+    int nthreads = pool_threads, ops = STRESS_OPS;
+    if (argc > 3 ||
+        (argc > 1 && (!get_int(argv[1], &nthreads) || nthreads < 1 ||
+                      nthreads > MPMC_MAX_THREADS)) ||
+        (argc > 2 && (!get_int(argv[2], &ops) || ops < 0))) {
+        report(1, "%s takes 1 to %d threads and a number of operations",
+               argv[0], MPMC_MAX_THREADS);
+        return false;
+    }
+
+    stress_job_t *jobs = calloc(nthreads, sizeof(stress_job_t));
+    pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+    if (!jobs || !tids) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for threads");
+        free(jobs);
+        free(tids);
+        return false;
+    }
+    error_check();
+
+    /* Every block the threads allocate has to be freed by the end */
+    size_t blocks = allocation_check();
+    mpmc_t *q = mpmc_new();
+    if (!q) {
+        report(1, "ERROR: Could not allocate lock-free queue");
+        free(jobs);
+        free(tids);
+        return false;
+    }
+
+    atomic_int running = nthreads;
+    bool ok = true;
+    int started = 0;
+    double start;
+    init_time(&start);
+    for (; started < nthreads; started++) {
+        jobs[started] = (stress_job_t){.q = q,
+                                       .id = started,
+                                       .ops = ops,
+                                       .running = &running};
+        if (pthread_create(&tids[started], NULL, stress_job, &jobs[started]))
+            break;
+    }
+    if (started < nthreads) {
+        report(1, "ERROR: Could only start %d of %d threads", started,
+               nthreads);
+        atomic_fetch_sub(&running, nthreads - started);
+        ok = false;
+    }
+
+    long inserted = 0, removed = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        inserted += jobs[i].inserted;
+        removed += jobs[i].removed;
+        ok = ok && jobs[i].ok;
+    }
+    double elapsed = delta_time(&start);
+    mpmc_free(q);
+
+    report(1, "%d threads: %ld inserted, %ld removed in %.3f s", started,
+           inserted, removed, elapsed);
+    size_t leaked = allocation_check() - blocks;
+    if (leaked) {
+        report(1, "ERROR: %zu blocks still allocated after stress", leaked);
+        ok = false;
+    }
+    free(jobs);
+    free(tids);
+
+    return ok && !error_check();
+}
+
+bool do_ttt(int argc, char *argv[])
+{
+    if (argc > 1)
+        ttt_game_mode = atoi(argv[1]);
+    start(argc, argv);
+    return true;
+}
+
+static void threads_changed(int oldval)
+{
+    if (pool_threads < 1) {
+        report(1, "ERROR: Need at least one worker thread");
+        pool_threads = oldval;
+    }
+}
+
+static void merge_threads_changed(int oldval)
+{
+    if (merge_threads < 0) {
+        report(1, "ERROR: Number of merge threads cannot be negative");
+        merge_threads = oldval;
+    }
+}
+
+static void async_free_changed(int oldval)
+{
+    if (async_free != 0 && async_free != 1) {
+        report(1, "ERROR: async_free must be 0 or 1");
+        async_free = oldval;
+    }
+}
+
+static void poison_changed(int oldval)
+{
+    if (poison_level < POISON_NONE || poison_level > POISON_FULL) {
+        report(1, "ERROR: Unknown poison level %d", poison_level);
+        poison_level = oldval;
+    }
+}
+
+static void time_limit_changed(int oldval)
+{
+    if (time_limit_ms < 1) {
+        report(1, "ERROR: Time limit must be at least 1 ms");
+        time_limit_ms = oldval;
+    }
+}
+
+static void alloc_cache_changed(int oldval)
+{
+    if (alloc_cache != 0 && alloc_cache != 1) {
+        report(1, "ERROR: alloc_cache must be 0 or 1");
+        alloc_cache = oldval;
+        return;
+    }
+    set_alloc_cache(alloc_cache);
+}
+
+static void alloc_profile_changed(int oldval)
+{
+    if (alloc_profile != 0 && alloc_profile != 1) {
+        report(1, "ERROR: alloc_profile must be 0 or 1");
+        alloc_profile = oldval;
+        return;
+    }
+    set_alloc_profile(alloc_profile);
+}
+
+static void console_init()
+{
+    ADD_COMMAND(new, "Create new queue", "");
+    ADD_COMMAND(free, "Delete queue", "");
+    ADD_COMMAND(reclaim,
+                "Wait for the queues freed in the background to be released",
+                "");
+    ADD_COMMAND(allocstats,
+                "Show the allocated blocks, the activity of the allocation "
+                "cache and the top n allocation sites",
+                "[n]");
+    ADD_COMMAND(clone,
+                "Add a copy-on-write snapshot of the queue to the chain", "");
+    ADD_COMMAND(compact,
+                "Relocate the elements of the queue into memory in list order",
+                "");
+    ADD_COMMAND(save, "Write the queue to snapshot file", "file");
+    ADD_COMMAND(load, "Add the queue saved in snapshot file to the chain",
+                "file");
+    ADD_COMMAND(prev, "Switch to previous queue", "");
+    ADD_COMMAND(next, "Switch to next queue", "");
+    ADD_COMMAND(ih,
+                "Insert value str at head of queue n times. Generate random "
+                "value(s) if str equals RAND. (default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(it,
+                "Insert value str at tail of queue n times. Generate random "
+                "value(s) if str equals RAND. (default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(
+        rh,
+        "Remove from head of queue. Optionally compare to expected value str",
+        "[str]");
+    ADD_COMMAND(
+        rt,
+        "Remove from tail of queue. Optionally compare to expected value str",
+        "[str]");
+    ADD_COMMAND(reverse, "Reverse queue", "");
+    ADD_COMMAND(shuffle, "Do Fisher-Yates shuffle", "");
+    ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
+    ADD_COMMAND(parallel,
+                "Run command cmd on every queue of the chain at once on "
+                "worker threads",
+                "cmd [args]");
+    ADD_COMMAND(psort,
+                "Sort every queue of the chain in parallel on worker threads",
+                "");
+    ADD_COMMAND(stress,
+                "Insert and remove strings on a lock-free queue from "
+                "threads at once, then check for leaks",
+                "[threads] [ops]");
+    ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
+    ADD_COMMAND(show, "Show queue contents", "");
+    ADD_COMMAND(dm, "Delete middle node in queue", "");
+    ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
+    ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
+    ADD_COMMAND(ascend,
+                "Remove every node which has a node with a strictly less "
+                "value anywhere to the right side of it",
+                "");
+    ADD_COMMAND(descend,
+                "Remove every node which has a node with a strictly greater "
+                "value anywhere to the right side of it",
+                "");
+    ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
+                "[K]");
+    ADD_COMMAND(pqpush,
+                "Push value str into the priority queue n times. Generate "
+                "random value(s) if str equals RAND. (default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(pqmin,
+                "Remove the minimum of the priority queue. Optionally compare "
+                "to expected value str",
+                "[str]");
+    ADD_COMMAND(pqmax,
+                "Remove the maximum of the priority queue. Optionally compare "
+                "to expected value str",
+                "[str]");
+    ADD_COMMAND(pqload, "Move every element of queue into the priority queue",
+                "");
+    ADD_COMMAND(pqsize, "Show the number of elements in the priority queue",
+                "");
+    ADD_COMMAND(pqfree, "Delete every element of the priority queue", "");
+    ADD_COMMAND(jopen,
+                "Recover the queue from journal file if it exists, then "
+                "journal its changes",
+                "file");
+    ADD_COMMAND(jclose, "Stop journaling, keeping the journal files", "");
+    ADD_COMMAND(jdrop, "Stop journaling and remove journal file for good",
+                "file");
+    ADD_COMMAND(jsync, "Write out and sync every journal record", "");
+    ADD_COMMAND(jcompact, "Fold the journal into a snapshot of the queue",
+                "");
+    ADD_COMMAND(jstat, "Show the activity and overhead of the journal", "");
+    ADD_COMMAND(shmcreate,
+                "Create shared-memory queue name with a segment of the given "
+                "size",
+                "name [bytes]");
+    ADD_COMMAND(shmattach, "Attach to existing shared-memory queue name",
+                "name");
+    ADD_COMMAND(shmdetach,
+                "Detach from the shared-memory queue, removing it if created "
+                "here",
+                "");
+    ADD_COMMAND(shmit,
+                "Insert string str at tail of the shared-memory queue n "
+                "times. Generate random string(s) if str equals RAND. "
+                "(default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(shmrh,
+                "Remove from head of the shared-memory queue. Optionally "
+                "compare to expected value str",
+                "[str]");
+    ADD_COMMAND(shmsize, "Show the number of strings in the shared queue",
+                "");
+    ADD_COMMAND(cqih,
+                "Insert value str at head of the compact queue n times. "
+                "Generate random value(s) if str equals RAND. (default: n == "
+                "1)",
+                "str [n]");
+    ADD_COMMAND(cqit,
+                "Insert value str at tail of the compact queue n times. "
+                "Generate random value(s) if str equals RAND. (default: n == "
+                "1)",
+                "str [n]");
+    ADD_COMMAND(cqrh,
+                "Remove from head of the compact queue. Optionally compare to "
+                "expected value str",
+                "[str]");
+    ADD_COMMAND(cqrt,
+                "Remove from tail of the compact queue. Optionally compare to "
+                "expected value str",
+                "[str]");
+    ADD_COMMAND(cqload, "Replace the compact queue with a copy of the queue",
+                "");
+    ADD_COMMAND(cqstore, "Add a copy of the compact queue to the chain", "");
+    ADD_COMMAND(cqop,
+                "Apply reverse, swap, sort, dedup, dm, ascend, descend or "
+                "reverseK k to the compact queue",
+                "op [k]");
+    ADD_COMMAND(cqsize,
+                "Show the number of elements and the memory of the compact "
+                "queue",
+                "");
+    ADD_COMMAND(cqfree, "Delete the compact queue", "");
+    ADD_COMMAND(ttt, "Start ttt game", "");
+    add_param("length", &string_length, "Maximum length of displayed string",
+              NULL);
+    add_param("malloc", &fail_probability, "Malloc failure probability percent",
+              NULL);
+    add_param_named("poison", &poison_level,
+                    "Payload bytes filled by malloc and free: none, edges "
+                    "(first and last cache line) or full",
+                    poison_names, poison_changed);
+    add_param("limit_ms", &time_limit_ms,
+              "Time limit of every queue operation in milliseconds",
+              time_limit_changed);
+    add_param("alloc_cache", &alloc_cache,
+              "Recycle small freed blocks by size class in the harness",
+              alloc_cache_changed);
+    add_param("alloc_profile", &alloc_profile,
+              "Profile allocations per call site, shown by allocstats",
+              alloc_profile_changed);
+    add_param("fail", &fail_limit,
+              "Number of times allow queue operations to return false", NULL);
+    add_param("descend", &descend,
+              "Sort and merge queue in ascending/descending order", NULL);
+    add_param("threads", &pool_threads,
+              "Number of worker threads for parallel commands",
+              threads_changed);
+    add_param("journal_group", &journal_group,
+              "Journal records per sync, 0 for jsync only (from next jopen)",
+              NULL);
+    add_param("journal_compact", &journal_compact_kb,
+              "KiB of journal records that trigger a snapshot, 0 for never "
+              "(from next jopen)",
+              NULL);
+    add_param("merge_threads", &merge_threads,
+              "Worker threads merging queues pairwise in parallel rounds (0: "
+              "serial merge)",
+              merge_threads_changed);
+    add_param("async_free", &async_free,
+              "Free queues on a background thread, waited for by reclaim",
+              async_free_changed);
+    add_param_named("type", &elem_type,
+                    "Type of inserted values: str, int or blob (\\xNN escapes)",
+                    elem_type_names, elem_type_changed);
     add_param("TTT_game_mode", &ttt_game_mode,
               "Select TTT game mode with plyer vs AI or AI vs AI", NULL);
 }
@@ -1119,6 +3107,7 @@ static void q_init()
 {
     fail_count = 0;
     INIT_LIST_HEAD(&chain.head);
+    pq_init(&pq);
     signal(SIGSEGV, sigsegv_handler);
     signal(SIGALRM, sigalrm_handler);
 }
@@ -1126,22 +3115,34 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
+    if (journal)
+        journal_stop();
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
         while (chain.size > 0) {
             queue_contex_t *qctx = list_entry(cur, queue_contex_t, chain);
             cur = cur->next;
-            q_free(qctx->q);
+            if (async_free)
+                q_free_async(qctx->q, get_reclaimer());
+            else
+                q_free(qctx->q);
             free(qctx);
             chain.size--;
         }
+        pq_free(&pq);
+        cq_free(cq);
+        cq = NULL;
     }
 
     exception_cancel();
-    set_cautious_mode(true);
+    tpool_free(pool);
+    pool = NULL;
+    tpool_free(merge_pool);
+    merge_pool = NULL;
+    tpool_free(reclaimer);
+    reclaimer = NULL;
+    shm_release();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
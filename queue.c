@@ -1,9 +1,16 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "queue.h"
 #include "sort_impl.h"
+#include "tpool.h"
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
  * but some of them cannot occur. You can suppress them by adding the
  * following line.
@@ -13,7 +20,7 @@ typedef void (*sort_fn)(struct list_head *head, list_cmp_func_t cmp);
 struct task {
     sort_fn sort;
 };
-struct task current_task;
+struct task current_task = {.sort = timsort};
 void sort_init()
 {
     current_task.sort = timsort;
@@ -27,7 +34,57 @@ int compare(void *priv, struct list_head *q1, struct list_head *q2)
     element_t *e2 = list_entry(q2, element_t, list);
     if (priv)
         *((int *) priv) += 1;
-    return strcmp(e1->value, e2->value);
+    return q_element_cmp(e1, e2);
+}
+
+/* Comparator for integer elements: the keys alone decide the order */
+static int compare_int(void *priv, struct list_head *q1, struct list_head *q2)
+{
+    uint64_t k1 = list_entry(q1, element_t, list)->prefix;
+    uint64_t k2 = list_entry(q2, element_t, list)->prefix;
+    if (priv)
+        *((int *) priv) += 1;
+    return (k1 > k2) - (k1 < k2);
+}
+
+/* Every string or blob buffer is preceded by a reference count, so that
+ * clones of a queue can share the buffers instead of copying them.
+ */
+typedef struct {
+    size_t refcnt;
+    char data[];
+} value_buf_t;
+
+static inline value_buf_t *value_buf(const char *value)
+{
+    return (value_buf_t *) (value - offsetof(value_buf_t, data));
+}
+
+/* Allocate a buffer for len bytes plus a null byte, with one reference */
+static char *value_alloc(size_t len)
+{
+    value_buf_t *buf = malloc(sizeof(value_buf_t) + len + 1);
+    if (!buf)
+        return NULL;
+    buf->refcnt = 1;
+    return buf->data;
+}
+
+static inline char *value_get(char *value)
+{
+    if (value)
+        __atomic_fetch_add(&value_buf(value)->refcnt, 1, __ATOMIC_RELAXED);
+    return value;
+}
+
+/* Drop a reference to an element buffer, freeing it with the last one */
+void q_value_put(char *value)
+{
+    if (!value)
+        return;
+    value_buf_t *buf = value_buf(value);
+    if (__atomic_sub_fetch(&buf->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+        free(buf);
 }
 
 int merge_two_queues(struct list_head *q1, struct list_head *q2, bool descend);
@@ -35,7 +92,7 @@ void q_node_free(struct list_head *node)
 {
     if (node) {
         element_t *tmp = list_entry(node, element_t, list);
-        free(tmp->value);
+        q_value_put(tmp->value);
         free(tmp);
     }
 }
@@ -52,6 +109,16 @@ struct list_head *q_new()
     return head;
 }
 
+/* Hint the value buffer of the entry at the lookahead of an iteration, which
+ * is a separate allocation the chase of the list does not bring in.
+ */
+static inline void prefetch_value(struct list_head *ahead,
+                                  struct list_head *head)
+{
+    if (ahead != head)
+        list_prefetch(list_entry(ahead, element_t, list)->value);
+}
+
 /* Free all storage used by queue */
 void q_free(struct list_head *l)
 {
@@ -59,58 +126,463 @@ void q_free(struct list_head *l)
         return;
     }
     element_t *entry, *safe;
-    list_for_each_entry_safe (entry, safe, l, list) {
-        free(entry->value);
+    struct list_head *ahead;
+    list_for_each_entry_safe_prefetch (entry, safe, ahead, l, list) {
+        prefetch_value(ahead, l);
+        q_value_put(entry->value);
         free(entry);
     }
     free(l);
 }
 
-/* Insert an element at head of queue */
-bool q_insert_head(struct list_head *head, char *s)
+#define FREE_BATCH 4096
+
+/* Free the queue a batch at a time, yielding in between so that a reclaimer
+ * sharing a CPU with the thread that queued the work does not hold it for
+ * the whole queue.
+ */
+static void free_job(void *arg)
 {
-    if (!head) {
+    struct list_head *l = arg;
+    int n = 0;
+    element_t *entry, *safe;
+    struct list_head *ahead;
+    list_for_each_entry_safe_prefetch (entry, safe, ahead, l, list) {
+        prefetch_value(ahead, l);
+        q_value_put(entry->value);
+        free(entry);
+        if (++n == FREE_BATCH) {
+            n = 0;
+            sched_yield();
+        }
+    }
+    free(l);
+}
+
+void q_free_async(struct list_head *l, tpool_t *pool)
+{
+    if (!l) {
+        return;
+    }
+    if (!pool || !tpool_submit(pool, free_job, l))
+        free_job(l);
+}
+
+/* Create a copy of the queue which shares the element buffers */
+struct list_head *q_clone(struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    struct list_head *copy = q_new();
+    if (!copy)
+        return NULL;
+
+    element_t *entry;
+    struct list_head *ahead;
+    list_for_each_entry_prefetch (entry, ahead, head, list) {
+        prefetch_value(ahead, head);
+        element_t *node = (element_t *) malloc(sizeof(element_t));
+        if (!node) {
+            q_free(copy);
+            return NULL;
+        }
+        *node = *entry;
+        value_get(node->value);
+        list_add_tail(&node->list, copy);
+    }
+    return copy;
+}
+
+#define PAGE_BYTES 4096
+
+/* Links between nodes which do not share a page, a proxy for the cache and
+ * TLB misses of a traversal.
+ */
+static size_t far_links(struct list_head *head)
+{
+    size_t far = 0;
+    struct list_head *node, *ahead;
+    list_for_each_prefetch (node, ahead, head) {
+        if (node->next == head)
+            break;
+        uintptr_t a = (uintptr_t) node, b = (uintptr_t) node->next;
+        far += (a > b ? a - b : b - a) >= PAGE_BYTES;
+    }
+    return far;
+}
+
+static int page_cmp(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *) a, y = *(const uintptr_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Pages holding the elements of head and their buffers, 0 if there is no
+ * memory to count them.  Only the first and last page of each block can be
+ * shared with other blocks, so only those are sorted and counted once.
+ */
+static size_t pages_used(struct list_head *head)
+{
+    if (list_empty(head))
+        return 0;
+    uintptr_t *ends = malloc(4 * q_size(head) * sizeof(uintptr_t));
+    if (!ends)
+        return 0;
+
+    size_t n = 0, inner = 0;
+    element_t *entry;
+    list_for_each_entry (entry, head, list) {
+        uintptr_t first = (uintptr_t) entry / PAGE_BYTES;
+        uintptr_t last = ((uintptr_t) (entry + 1) - 1) / PAGE_BYTES;
+        ends[n++] = first;
+        ends[n++] = last;
+        if (!entry->value)
+            continue;
+        first = (uintptr_t) value_buf(entry->value) / PAGE_BYTES;
+        last = (uintptr_t) (entry->value + entry->len) / PAGE_BYTES;
+        ends[n++] = first;
+        ends[n++] = last;
+        if (last > first)
+            inner += last - first - 1;
+    }
+    qsort(ends, n, sizeof(*ends), page_cmp);
+
+    size_t pages = inner;
+    for (size_t i = 0; i < n; i++)
+        pages += !i || ends[i] != ends[i - 1];
+    free(ends);
+    return pages;
+}
+
+/* Under the test harness, the copies made by a compaction are carved one
+ * after the other out of large chunks, rather than taken from its cache or
+ * from malloc, which hand back memory scattered by earlier frees.  The C
+ * library offers no such mode, so libqueue only relies on malloc.
+ */
+static void alloc_packed(bool packed)
+{
+#ifndef QUEUE_STANDALONE
+    test_alloc_packed(packed);
+#else
+    (void) packed;
+#endif
+}
+
+/* Undo a relocation in progress: fresh holds the copies of the first
+ * elements of head, which are still intact.
+ */
+static void compact_abort(struct list_head *fresh, struct list_head *head)
+{
+    alloc_packed(false);
+    struct list_head *old = head->next;
+    element_t *entry, *safe;
+    list_for_each_entry_safe (entry, safe, fresh, list) {
+        if (entry->value != list_entry(old, element_t, list)->value)
+            free(value_buf(entry->value));
+        free(entry);
+        old = old->next;
+    }
+}
+
+bool q_compact(struct list_head *head, q_compact_stats_t *stats)
+{
+    if (!head)
         return false;
+    q_compact_stats_t st = {0};
+    if (stats) {
+        st.far_before = far_links(head);
+        st.pages_before = pages_used(head);
     }
-    int len = strlen(s) + 1;
+
+    /* Copy everything first, so that failing halfway changes nothing */
+    LIST_HEAD(fresh);
+    alloc_packed(true);
+    element_t *entry, *safe;
+    struct list_head *ahead;
+    list_for_each_entry_prefetch (entry, ahead, head, list) {
+        prefetch_value(ahead, head);
+        element_t *node = malloc(sizeof(element_t));
+        if (!node) {
+            compact_abort(&fresh, head);
+            return false;
+        }
+        *node = *entry;
+        if (entry->value && __atomic_load_n(&value_buf(entry->value)->refcnt,
+                                            __ATOMIC_ACQUIRE) == 1) {
+            node->value = value_alloc(entry->len);
+            if (!node->value) {
+                free(node);
+                compact_abort(&fresh, head);
+                return false;
+            }
+            memcpy(node->value, entry->value, entry->len + 1);
+        } else if (entry->value) {
+            st.shared++;
+        }
+        list_add_tail(&node->list, &fresh);
+        st.moved++;
+    }
+    alloc_packed(false);
+
+    /* A buffer left in place now belongs to the copy of its element */
+    struct list_head *copy = fresh.next;
+    list_for_each_entry_safe_prefetch (entry, safe, ahead, head, list) {
+        if (entry->value != list_entry(copy, element_t, list)->value)
+            free(value_buf(entry->value));
+        free(entry);
+        copy = copy->next;
+    }
+    INIT_LIST_HEAD(head);
+    list_splice(&fresh, head);
+
+    if (stats) {
+        st.far_after = far_links(head);
+        st.pages_after = pages_used(head);
+        *stats = st;
+    }
+    return true;
+}
+
+/* Snapshot file: a header, then one record per element in queue order.
+ * Records are 8-byte aligned; integers hold their 8-byte key and strings
+ * and blobs their bytes without the null byte. Fields are in host byte
+ * order, so snapshots are only meant for the machine that wrote them.
+ */
+#define SNAPSHOT_MAGIC "lab0q\0\0\1"
+
+typedef struct {
+    char magic[8];
+    uint64_t count;
+} snapshot_hdr_t;
+
+typedef struct {
+    uint32_t len;
+    uint32_t type;
+    char data[];
+} snapshot_rec_t;
+
+static inline size_t record_size(size_t payload)
+{
+    return (sizeof(snapshot_rec_t) + payload + 7) & ~(size_t) 7;
+}
+
+bool q_save(struct list_head *head, const char *path)
+{
+    if (!head || !path)
+        return false;
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    static const char pad[8];
+    snapshot_hdr_t hdr = {.magic = SNAPSHOT_MAGIC, .count = q_size(head)};
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    element_t *e;
+    struct list_head *ahead;
+    list_for_each_entry_prefetch (e, ahead, head, list) {
+        if (!ok)
+            break;
+        prefetch_value(ahead, head);
+        snapshot_rec_t rec = {.len = e->len, .type = e->type};
+        const void *data = e->value;
+        size_t payload = e->len;
+        if (e->type == Q_INT) {
+            data = &e->prefix;
+            payload = sizeof(e->prefix);
+        }
+        size_t fill = record_size(payload) - sizeof(rec) - payload;
+        ok = fwrite(&rec, sizeof(rec), 1, f) == 1 &&
+             fwrite(data, 1, payload, f) == payload &&
+             fwrite(pad, 1, fill, f) == fill;
+    }
+    if (fclose(f) || !ok) {
+        remove(path);
+        return false;
+    }
+    return true;
+}
+
+/* Build the elements of a mapped snapshot of size bytes into head */
+static bool load_records(struct list_head *head, const char *map, size_t size)
+{
+    const snapshot_hdr_t *hdr = (const snapshot_hdr_t *) map;
+    if (size < sizeof(*hdr) ||
+        memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)))
+        return false;
+
+    size_t off = sizeof(*hdr);
+    for (uint64_t i = 0; i < hdr->count; i++) {
+        if (size - off < sizeof(snapshot_rec_t))
+            return false;
+        const snapshot_rec_t *rec = (const snapshot_rec_t *) (map + off);
+        size_t payload = rec->type == Q_INT ? sizeof(uint64_t) : rec->len;
+        if (rec->type > Q_BLOB || size - off < record_size(payload))
+            return false;
+
+        element_t *e;
+        if (rec->type == Q_INT) {
+            uint64_t key;
+            memcpy(&key, rec->data, sizeof(key));
+            e = q_element_new_int((int64_t) (key ^ (UINT64_C(1) << 63)));
+        } else {
+            e = q_element_new(rec->type, rec->data, rec->len);
+        }
+        if (!e)
+            return false;
+        list_add_tail(&e->list, head);
+        off += record_size(payload);
+    }
+    return off == size;
+}
+
+struct list_head *q_load(const char *path)
+{
+    if (!path)
+        return NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    struct list_head *head = q_new();
+    if (head && !load_records(head, map, st.st_size)) {
+        q_free(head);
+        head = NULL;
+    }
+    munmap(map, st.st_size);
+    return head;
+}
+
+/* Give the element a private copy of its buffer if it is shared */
+bool q_element_unshare(element_t *e)
+{
+    if (!e->value || __atomic_load_n(&value_buf(e->value)->refcnt,
+                                     __ATOMIC_ACQUIRE) == 1)
+        return true;
+    char *value = value_alloc(e->len);
+    if (!value)
+        return false;
+    memcpy(value, e->value, e->len + 1);
+    q_value_put(e->value);
+    e->value = value;
+    return true;
+}
+
+/* Allocate an element holding a copy of len bytes of data, with its key
+ * cached. A null byte is always appended after the copy.
+ */
+element_t *q_element_new(q_type_t type, const void *data, size_t len)
+{
+    if (len > UINT32_MAX)
+        return NULL;
     element_t *node = (element_t *) malloc(sizeof(element_t));
     if (!node)
-        return false;
+        return NULL;
 
-    node->value = malloc(len);
+    node->value = value_alloc(len);
     if (!node->value) {
         free(node);
-        return false;
+        return NULL;
     }
-    strncpy(node->value, s, len);
-    if (list_empty(head)) {
-        list_add_tail(&node->list, head);
-    } else {
-        list_add(&node->list, head);
+    memcpy(node->value, data, len);
+    node->value[len] = '\0';
+    node->type = type;
+    q_element_setkey(node, len);
+    return node;
+}
+
+element_t *q_element_new_int(int64_t v)
+{
+    element_t *node = (element_t *) malloc(sizeof(element_t));
+    if (!node)
+        return NULL;
+    q_element_setint(node, v);
+    return node;
+}
+
+/* Copy the payload of a removed element to sp, up to bufsize - 1 bytes */
+static void element_copy_out(const element_t *e, char *sp, size_t bufsize)
+{
+    if (!sp || !bufsize)
+        return;
+    if (e->type == Q_INT) {
+        snprintf(sp, bufsize, "%" PRId64, q_element_int(e));
+        return;
     }
+    if (!e->value)
+        return;
+    size_t n = e->len < bufsize - 1 ? e->len : bufsize - 1;
+    memcpy(sp, e->value, n);
+    sp[n] = '\0';
+}
 
+/* Link a newly created element at the head or tail of the queue */
+static bool element_insert(struct list_head *head, element_t *node, bool tail)
+{
+    if (!node)
+        return false;
+    if (tail)
+        list_add_tail(&node->list, head);
+    else
+        list_add(&node->list, head);
     return true;
 }
 
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    if (!head) {
+        return false;
+    }
+    return element_insert(head, q_element_new(Q_STR, s, strlen(s)), false);
+}
+
 /* Insert an element at tail of queue */
 bool q_insert_tail(struct list_head *head, char *s)
 {
     if (!head) {
         return false;
     }
-    int len = strlen(s) + 1;
-    element_t *node = (element_t *) malloc(sizeof(element_t));
-    if (!node)
+    return element_insert(head, q_element_new(Q_STR, s, strlen(s)), true);
+}
+
+/* Insert an integer element at head of queue */
+bool q_insert_head_int(struct list_head *head, int64_t v)
+{
+    if (!head)
         return false;
-    node->value = malloc(len);
-    if (!node->value) {
-        free(node);
+    return element_insert(head, q_element_new_int(v), false);
+}
+
+/* Insert an integer element at tail of queue */
+bool q_insert_tail_int(struct list_head *head, int64_t v)
+{
+    if (!head)
         return false;
-    }
-    strncpy(node->value, s, len);
-    list_add_tail(&node->list, head);
+    return element_insert(head, q_element_new_int(v), true);
+}
 
-    return true;
+/* Insert a blob element at head of queue */
+bool q_insert_head_blob(struct list_head *head, const void *data, size_t len)
+{
+    if (!head)
+        return false;
+    return element_insert(head, q_element_new(Q_BLOB, data, len), false);
+}
+
+/* Insert a blob element at tail of queue */
+bool q_insert_tail_blob(struct list_head *head, const void *data, size_t len)
+{
+    if (!head)
+        return false;
+    return element_insert(head, q_element_new(Q_BLOB, data, len), true);
 }
 
 /* Remove an element from head of queue */
@@ -121,10 +593,7 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
     }
     element_t *first_elem = list_first_entry(head, element_t, list);
     list_del(&first_elem->list);
-    if (sp && first_elem->value) {
-        strncpy(sp, first_elem->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
+    element_copy_out(first_elem, sp, bufsize);
     return first_elem;
 }
 
@@ -136,10 +605,7 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
     }
     element_t *last_elem = list_last_entry(head, element_t, list);
     list_del(&last_elem->list);
-    if (sp && last_elem->value) {
-        strncpy(sp, last_elem->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
+    element_copy_out(last_elem, sp, bufsize);
     return last_elem;
 }
 
@@ -171,9 +637,7 @@ bool q_delete_mid(struct list_head *head)
         slow = slow->next;
     }
     list_del(slow);
-    element_t *entry = container_of(slow, element_t, list);
-    free(entry->value);
-    free(entry);
+    q_node_free(slow);
     return true;
 }
 
@@ -189,8 +653,8 @@ bool q_delete_dup(struct list_head *head)
     struct list_head *pending = q_new();
     list_for_each_entry_safe (entry, safe, head, list) {
         while (entry->list.next != head &&
-               !strcmp(entry->value,
-                       list_entry(entry->list.next, element_t, list)->value)) {
+               q_element_equal(
+                   entry, list_entry(entry->list.next, element_t, list))) {
             tmp = entry->list.next;
             list_move(tmp, pending);
         }
@@ -250,14 +714,73 @@ void q_reverseK(struct list_head *head, int k)
     }
 }
 
+/* Up to this many 8-bit digits LSD radix sort beats merge sort; each pass
+ * scatters every node, so wider keys are merge sorted with compare_int().
+ */
+#define RADIX_MAX_PASSES 4
+
+/* Bits which are not the same in every key of an integer queue */
+static uint64_t varying_bits(struct list_head *head)
+{
+    uint64_t all_or = 0, all_and = ~UINT64_C(0);
+    element_t *entry;
+    struct list_head *ahead;
+
+    list_for_each_entry_prefetch (entry, ahead, head, list) {
+        all_or |= entry->prefix;
+        all_and &= entry->prefix;
+    }
+    return all_or & ~all_and;
+}
+
+static int radix_passes(uint64_t varying)
+{
+    int passes = 0;
+    for (int shift = 0; shift < 64; shift += 8)
+        passes += !!((varying >> shift) & 0xff);
+    return passes;
+}
+
+/* Stable LSD radix sort of an integer queue on the 64-bit keys. Digits which
+ * are the same in every key are skipped. The buckets live on the stack:
+ * sorting must not allocate.
+ */
+static void radix_sort(struct list_head *head, uint64_t varying)
+{
+    struct list_head bucket[256];
+    element_t *entry, *safe;
+    struct list_head *ahead;
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (!((varying >> shift) & 0xff))
+            continue;
+        for (int i = 0; i < 256; i++)
+            INIT_LIST_HEAD(&bucket[i]);
+        list_for_each_entry_safe_prefetch (entry, safe, ahead, head, list) {
+            uint8_t digit = entry->prefix >> shift;
+            list_move_tail(&entry->list, &bucket[digit]);
+        }
+        for (int i = 0; i < 256; i++)
+            list_splice_tail(&bucket[i], head);
+    }
+}
+
 /* Sort elements of queue in ascending/descending order */
 void q_sort(struct list_head *head, bool descend)
 {
     if (!head || list_empty(head) || list_is_singular(head)) {
         return;
     }
-    sort_init();
-    current_task.sort(head, compare);
+    if (list_first_entry(head, element_t, list)->type == Q_INT) {
+        uint64_t varying = varying_bits(head);
+        if (radix_passes(varying) <= RADIX_MAX_PASSES) {
+            radix_sort(head, varying);
+        } else {
+            current_task.sort(head, compare_int);
+        }
+    } else {
+        current_task.sort(head, compare);
+    }
     if (descend) {
         q_reverse(head);
     }
@@ -299,7 +822,7 @@ int q_ascend(struct list_head *head)
 
     list_for_each_entry_safe (left, right, head, list) {
         count++;
-        if (&right->list != head && strcmp(left->value, right->value) > 0) {
+        if (&right->list != head && q_element_cmp(left, right) > 0) {
             list_move(&right->list, pending);
             right = left;
             count--;
@@ -322,8 +845,8 @@ int q_descend(struct list_head *head)
     node = head->prev;
     count = q_size(head);
     while (node->prev != head) {
-        if (strcmp(list_entry(node, element_t, list)->value,
-                   list_entry(node->prev, element_t, list)->value) > 0) {
+        if (q_element_cmp(list_entry(node, element_t, list),
+                          list_entry(node->prev, element_t, list)) > 0) {
             pending = node->prev;
             list_del(pending);
             q_node_free(pending);
@@ -349,8 +872,7 @@ int merge_two_queues(struct list_head *q1, struct list_head *q2, bool descend)
     q2 = q2->next;
     list_for_each_entry_safe (entry, safe, q1, list) {
         if (descend) {
-            while (strcmp(entry->value,
-                          list_entry(q2, element_t, list)->value) < 0) {
+            while (q_element_cmp(entry, list_entry(q2, element_t, list)) < 0) {
                 if (q2->next == q2_head) {
                     q2 = q2->next;
                     list_move(q2->prev, entry->list.prev);
@@ -361,8 +883,7 @@ int merge_two_queues(struct list_head *q1, struct list_head *q2, bool descend)
                 }
             }
         } else {
-            while (strcmp(entry->value,
-                          list_entry(q2, element_t, list)->value) > 0) {
+            while (q_element_cmp(entry, list_entry(q2, element_t, list)) > 0) {
                 if (q2->next == q2_head) {
                     q2 = q2->next;
                     list_move(q2->prev, entry->list.prev);
@@ -401,6 +922,67 @@ int q_merge(struct list_head *head, bool descend)
     return count;
 }
 
+/* Pairs merged per batch of tasks, so that no allocation is needed */
+#define MERGE_BATCH 64
+
+typedef struct {
+    struct list_head *q1, *q2;
+    bool descend;
+} merge_job_t;
+
+static void merge_job(void *arg)
+{
+    merge_job_t *job = arg;
+    merge_two_queues(job->q1, job->q2, job->descend);
+}
+
+/* Run the jobs on pool, or in the calling thread without one */
+static void merge_batch(tpool_t *pool, merge_job_t *jobs, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (!pool || !tpool_submit(pool, merge_job, &jobs[i]))
+            merge_job(&jobs[i]);
+    }
+    if (pool)
+        tpool_wait(pool);
+}
+
+/* Merge all the queues into the first one by merging neighbours in rounds:
+ * queue i takes queue i + 1 in the first round, queue i + 2 in the second,
+ * and so on. Ties keep the element of the left queue first, exactly like
+ * the sequential q_merge(), so both produce the same order.
+ */
+int q_merge_parallel(struct list_head *head, bool descend, tpool_t *pool)
+{
+    if (!head || list_empty(head)) {
+        return 0;
+    }
+
+    int k = q_size(head);
+    merge_job_t jobs[MERGE_BATCH];
+    for (int stride = 1; stride < k; stride *= 2) {
+        int n = 0, idx = 0;
+        struct list_head *left = NULL, *node;
+        list_for_each (node, head) {
+            queue_contex_t *ctx = list_entry(node, queue_contex_t, chain);
+            if (idx % (2 * stride) == 0) {
+                left = ctx->q;
+            } else if (idx % (2 * stride) == stride) {
+                jobs[n].q1 = left;
+                jobs[n].q2 = ctx->q;
+                jobs[n].descend = descend;
+                if (++n == MERGE_BATCH) {
+                    merge_batch(pool, jobs, n);
+                    n = 0;
+                }
+            }
+            idx++;
+        }
+        merge_batch(pool, jobs, n);
+    }
+    return q_size(list_first_entry(head, queue_contex_t, chain)->q);
+}
+
 void q_shuffle(struct list_head *head)
 {
     if (!head || list_empty(head) || list_is_singular(head)) {
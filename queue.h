@@ -5,26 +5,144 @@
  * operations.
  *
  * It uses a circular doubly-linked list to represent the set of queue elements
+ *
+ * Built with QUEUE_STANDALONE defined, as for libqueue, the queue allocates
+ * with the C library directly instead of going through the test harness.
  */
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
+#ifndef QUEUE_STANDALONE
 #include "harness.h"
+#endif
 #include "list.h"
+#include "str_simd.h"
+
+/* libqueue.so is built with -fvisibility=hidden: only what the public
+ * headers declare between these pragmas is exported from it.
+ */
+#pragma GCC visibility push(default)
+
+/* Thread pool of tpool.h, only passed through by pointer here */
+typedef struct tpool tpool_t;
+
+/**
+ * q_type_t - Type of the payload held by an element
+ * @Q_STR: null-terminated string
+ * @Q_INT: signed 64-bit integer, @value is NULL
+ * @Q_BLOB: length-delimited bytes which may contain null bytes
+ */
+typedef enum { Q_STR, Q_INT, Q_BLOB } q_type_t;
 
 /**
  * element_t - Linked list element
- * @value: pointer to array holding string
+ * @value: pointer to array holding string or blob bytes, NULL for integers
  * @list: node of a doubly-linked list
- *
- * @value needs to be explicitly allocated and freed
+ * @prefix: first 8 bytes of @value in big-endian order, zero padded, or the
+ *          integer with its sign bit flipped
+ * @len: length of @value, excluding the terminating null byte
+ * @type: payload type, one of q_type_t
+ *
+ * @value needs to be explicitly allocated and freed. It is reference counted
+ * so that clones can share it, and must be released with q_value_put().
+ * @prefix and @len are cached by q_element_setkey() so that most comparisons
+ * are decided by a single integer compare without touching the string
+ * buffer. Blobs are stored with a terminating null byte as well, which is not
+ * counted in @len.
  */
 typedef struct {
     char *value;
     struct list_head list;
+    uint64_t prefix;
+    uint32_t len;
+    uint32_t type;
 } element_t;
 
+/**
+ * q_element_setkey() - Cache the comparison key of an element
+ * @e: element whose @value has been filled in
+ * @len: length of @value, excluding the terminating null byte
+ */
+static inline void q_element_setkey(element_t *e, size_t len)
+{
+    uint64_t prefix = 0;
+    memcpy(&prefix, e->value, len < 8 ? len : 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    prefix = __builtin_bswap64(prefix);
+#endif
+    e->prefix = prefix;
+    e->len = len;
+}
+
+/**
+ * q_element_setint() - Store an integer payload in an element
+ * @e: element to fill in
+ * @v: the integer
+ *
+ * Flipping the sign bit makes the unsigned order of @prefix match the signed
+ * order of the integers, so the comparators need no special case.
+ */
+static inline void q_element_setint(element_t *e, int64_t v)
+{
+    e->value = NULL;
+    e->prefix = (uint64_t) v ^ (UINT64_C(1) << 63);
+    e->len = 0;
+    e->type = Q_INT;
+}
+
+/**
+ * q_element_int() - Get the integer payload of an element
+ * @e: element of type Q_INT
+ *
+ * Return: the integer stored by q_element_setint()
+ */
+static inline int64_t q_element_int(const element_t *e)
+{
+    return (int64_t) (e->prefix ^ (UINT64_C(1) << 63));
+}
+
+/**
+ * q_element_cmp() - Compare the payloads of two elements of the same type
+ * @a: first element
+ * @b: second element
+ *
+ * Strings and blobs are ordered like memcmp() with the shorter one first on
+ * a common prefix; integers numerically. Only compares the bytes past the
+ * cached prefix, with str_bytes_cmp(), when the prefixes are equal.
+ *
+ * Return: negative, zero or positive, with the same sign as strcmp()
+ */
+static inline int q_element_cmp(const element_t *a, const element_t *b)
+{
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    uint32_t n = a->len < b->len ? a->len : b->len;
+    if (n > 8) {
+        int r = str_bytes_cmp(a->value + 8, b->value + 8, n - 8);
+        if (r)
+            return r;
+    }
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+/**
+ * q_element_equal() - Check whether two elements hold the same payload
+ * @a: first element
+ * @b: second element
+ *
+ * Return: true if the payloads are identical
+ */
+static inline bool q_element_equal(const element_t *a, const element_t *b)
+{
+    return a->prefix == b->prefix && a->len == b->len &&
+           (a->len <= 8 ||
+            str_bytes_eq(a->value + 8, b->value + 8, a->len - 8));
+}
+
 /**
  * queue_contex_t - The context managing a chain of queues
  * @q: pointer to the head of the queue
@@ -41,6 +159,24 @@ typedef struct {
 
 /* Operations on queue */
 
+/**
+ * q_element_new() - Allocate an unlinked element holding a copy of a value
+ * @type: Q_STR or Q_BLOB
+ * @data: bytes of the value
+ * @len: number of bytes, excluding any terminating null byte
+ *
+ * Return: the element, NULL for allocation failed
+ */
+element_t *q_element_new(q_type_t type, const void *data, size_t len);
+
+/**
+ * q_element_new_int() - Allocate an unlinked element holding an integer
+ * @v: the integer
+ *
+ * Return: the element, NULL for allocation failed
+ */
+element_t *q_element_new_int(int64_t v);
+
 /**
  * q_new() - Create an empty queue whose next and prev pointer point to itself
  *
@@ -54,6 +190,106 @@ struct list_head *q_new();
  */
 void q_free(struct list_head *head);
 
+/**
+ * q_free_async() - Hand a queue to a pool to be freed in the background
+ * @head: header of queue, may be NULL
+ * @pool: worker threads doing the freeing, NULL to free in the caller
+ *
+ * The queue is passed as it is, so this takes constant time whatever its
+ * size; the caller must not touch @head or its elements afterwards.  The
+ * elements are released in batches by a task of @pool, and tpool_wait()
+ * returns once every queue handed over has been freed.  Falls back to
+ * q_free() if the task cannot be submitted.
+ */
+void q_free_async(struct list_head *head, tpool_t *pool);
+
+/**
+ * q_clone() - Create a copy-on-write snapshot of a queue
+ * @head: header of queue
+ *
+ * The copy gets its own list nodes, since those carry the links, but shares
+ * the string and blob buffers with the original. The buffers are reference
+ * counted and only copied by q_element_unshare() when an element of either
+ * queue is about to modify its value in place.
+ *
+ * Return: header of the copy, NULL for allocation failed or queue is NULL
+ */
+struct list_head *q_clone(struct list_head *head);
+
+/**
+ * q_compact_stats_t - What q_compact() did to a queue
+ * @moved: elements relocated
+ * @shared: buffers left in place because other queues share them
+ * @far_before: links between nodes more than a page apart before
+ * @far_after: links between nodes more than a page apart after
+ * @pages_before: pages holding elements and buffers before, 0 if they
+ *                could not be counted for want of memory
+ * @pages_after: pages holding them after, likewise
+ */
+typedef struct {
+    size_t moved, shared, far_before, far_after;
+    size_t pages_before, pages_after;
+} q_compact_stats_t;
+
+/**
+ * q_compact() - Relocate the elements of a queue in list order
+ * @head: header of queue
+ * @stats: filled in when not NULL
+ *
+ * Every element, followed by its buffer, is copied into freshly allocated
+ * memory in the order of the list, and the old copies are freed, so that
+ * later traversals walk memory in the order it was handed out rather than
+ * wherever shuffles, sorts and removals scattered it. Under the test
+ * harness the copies are packed one after the other into large chunks,
+ * bypassing its cache of freed blocks. Buffers shared with clones stay
+ * where they are. The order and values do not change.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL,
+ * in which case the queue is left as it was
+ */
+bool q_compact(struct list_head *head, q_compact_stats_t *stats);
+
+/**
+ * q_save() - Write a queue to a snapshot file
+ * @head: header of queue
+ * @path: file to create or overwrite
+ *
+ * The file holds one length-prefixed record per element in a compact
+ * binary format meant to be read back by q_load() on the same machine.
+ *
+ * Return: true for success, false if the file could not be written, in
+ * which case it is removed
+ */
+bool q_save(struct list_head *head, const char *path);
+
+/**
+ * q_load() - Create a queue from a snapshot file
+ * @path: file written by q_save()
+ *
+ * The file is mapped rather than read, and each value is copied once from
+ * the mapping into its element.
+ *
+ * Return: header of the new queue, NULL if the file is missing, malformed
+ * or allocation failed
+ */
+struct list_head *q_load(const char *path);
+
+/**
+ * q_element_unshare() - Make the buffer of an element private before writing
+ * @e: element whose value is about to be modified
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool q_element_unshare(element_t *e);
+
+/**
+ * q_value_put() - Drop a reference to the buffer of an element
+ * @value: buffer, no effect if NULL
+ *
+ * The buffer is freed once the last queue sharing it lets go of it.
+ */
+void q_value_put(char *value);
+
 /**
  * q_insert_head() - Insert an element in the head
  * @head: header of queue
@@ -78,6 +314,46 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_head_int() - Insert an integer element in the head
+ * @head: header of queue
+ * @v: integer would be inserted
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_int(struct list_head *head, int64_t v);
+
+/**
+ * q_insert_tail_int() - Insert an integer element at the tail
+ * @head: header of queue
+ * @v: integer would be inserted
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_int(struct list_head *head, int64_t v);
+
+/**
+ * q_insert_head_blob() - Insert a blob element in the head
+ * @head: header of queue
+ * @data: bytes would be inserted, may contain null bytes
+ * @len: number of bytes
+ *
+ * The bytes are copied into newly allocated space.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_blob(struct list_head *head, const void *data, size_t len);
+
+/**
+ * q_insert_tail_blob() - Insert a blob element at the tail
+ * @head: header of queue
+ * @data: bytes would be inserted, may contain null bytes
+ * @len: number of bytes
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_blob(struct list_head *head, const void *data, size_t len);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -86,6 +362,7 @@ bool q_insert_tail(struct list_head *head, char *s);
  *
  * If sp is non-NULL and an element is removed, copy the removed string to *sp
  * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * Blobs are copied as raw bytes and integers in decimal notation.
  *
  * NOTE: "remove" is different from "delete"
  * The space used by the list element and the string should not be freed.
@@ -116,8 +393,12 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
+    q_value_put(e->value);
+#ifdef QUEUE_STANDALONE
+    free(e);
+#else
     test_free(e);
+#endif
 }
 
 /**
@@ -196,7 +477,7 @@ void q_reverseK(struct list_head *head, int k);
  * @descend: whether or not to sort in descending order
  *
  * No effect if queue is NULL or empty. If there has only one element, do
- * nothing.
+ * nothing. Queues of integers with narrow keys are radix sorted.
  */
 void q_sort(struct list_head *head, bool descend);
 
@@ -250,4 +531,21 @@ int q_descend(struct list_head *head);
  */
 int q_merge(struct list_head *head, bool descend);
 
+/**
+ * q_merge_parallel() - Merge all the queues of a chain as a parallel tree
+ * reduction
+ * @head: header of chain
+ * @descend: whether to merge queues sorted in descending order
+ * @pool: worker threads running the merges, NULL to merge in the caller
+ *
+ * Same contract and result as q_merge(), element for element.  Neighbouring
+ * queues are merged pairwise in log2(k) rounds, and the merges of a round
+ * run concurrently on @pool.  Must not be called from a task of @pool.
+ *
+ * Return: the number of elements in queue after merging
+ */
+int q_merge_parallel(struct list_head *head, bool descend, tpool_t *pool);
+
+#pragma GCC visibility pop
+
 #endif /* LAB0_QUEUE_H */
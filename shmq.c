@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shmq.h"
+
+/* "lab0shmq", written last by the creator once the header is ready */
+#define SHMQ_MAGIC 0x716d68733062616cULL
+
+#define ALIGN 8
+
+/* Offset of a node from the start of the segment, 0 for none */
+typedef uint64_t shm_off_t;
+
+typedef struct {
+    shm_off_t next;
+    uint64_t len;
+    char str[];
+} shm_node_t;
+
+/* Lives at offset 0 of the segment, so no node has offset 0.
+ *
+ * Nodes occupy [head, alloc) of the node area, or [head, end) and
+ * [data, alloc) once the ring has wrapped; alloc <= head tells the two
+ * apart while the queue is not empty.
+ */
+typedef struct {
+    _Atomic uint64_t magic;
+    uint64_t size;
+    uint64_t data;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+
+    /* Guarded by lock.  used counts the bytes of the nodes.  Waiters are
+     * counted by themselves and uncounted by whoever wakes them, so that
+     * the common path stays out of the kernel, and blocked producers are
+     * only woken once half of the node area is free again.
+     */
+    shm_off_t head, tail, alloc;
+    uint64_t count, used;
+    uint32_t empty_waiters, full_waiters;
+    bool closed;
+} shm_hdr_t;
+
+struct shmq {
+    shm_hdr_t *hdr;
+    size_t size;
+};
+
+static inline size_t align_up(size_t n)
+{
+    return (n + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+}
+
+static inline shm_node_t *node_at(shmq_t *q, shm_off_t off)
+{
+    return (shm_node_t *) ((char *) q->hdr + off);
+}
+
+/* Take the lock even if its owner died holding it.  The critical sections
+ * below are a handful of stores, so the queue is used as the owner left it.
+ */
+static void lock(shm_hdr_t *h)
+{
+    if (pthread_mutex_lock(&h->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&h->lock);
+}
+
+static void wait_on(shm_hdr_t *h, pthread_cond_t *cond, uint32_t *waiters)
+{
+    (*waiters)++;
+    if (pthread_cond_wait(cond, &h->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&h->lock);
+}
+
+static inline size_t node_size(size_t len)
+{
+    return (sizeof(shm_node_t) + len + 1 + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+}
+
+static bool init_header(shm_hdr_t *h, size_t size)
+{
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    bool ok = !pthread_mutex_init(&h->lock, &ma) &&
+              !pthread_cond_init(&h->not_empty, &ca) &&
+              !pthread_cond_init(&h->not_full, &ca);
+    pthread_mutexattr_destroy(&ma);
+    pthread_condattr_destroy(&ca);
+
+    h->size = size;
+    h->data = align_up(sizeof(shm_hdr_t));
+    h->head = h->tail = 0;
+    h->alloc = h->data;
+    h->count = h->used = 0;
+    h->empty_waiters = h->full_waiters = 0;
+    h->closed = false;
+    return ok;
+}
+
+static shmq_t *map(int fd, size_t size)
+{
+    shmq_t *q = malloc(sizeof(shmq_t));
+    if (!q)
+        return NULL;
+    q->hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (q->hdr == MAP_FAILED) {
+        free(q);
+        return NULL;
+    }
+    q->size = size;
+    return q;
+}
+
+shmq_t *shmq_create(const char *name, size_t size)
+{
+    if (size < align_up(sizeof(shm_hdr_t)) + sizeof(shm_node_t) + ALIGN)
+        return NULL;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    shmq_t *q = NULL;
+    if (!ftruncate(fd, size))
+        q = map(fd, size);
+    close(fd);
+
+    if (!q || !init_header(q->hdr, size)) {
+        shmq_detach(q);
+        shm_unlink(name);
+        return NULL;
+    }
+    atomic_store_explicit(&q->hdr->magic, SHMQ_MAGIC, memory_order_release);
+    return q;
+}
+
+shmq_t *shmq_attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    shmq_t *q = NULL;
+    if (!fstat(fd, &st) && (size_t) st.st_size >= sizeof(shm_hdr_t))
+        q = map(fd, st.st_size);
+    close(fd);
+
+    /* Still being created by another process, or not a queue */
+    if (q && (atomic_load_explicit(&q->hdr->magic, memory_order_acquire) !=
+                  SHMQ_MAGIC ||
+              q->hdr->size != q->size)) {
+        shmq_detach(q);
+        q = NULL;
+    }
+    return q;
+}
+
+void shmq_detach(shmq_t *q)
+{
+    if (!q)
+        return;
+    munmap(q->hdr, q->size);
+    free(q);
+}
+
+bool shmq_unlink(const char *name)
+{
+    return !shm_unlink(name);
+}
+
+void shmq_close(shmq_t *q)
+{
+    shm_hdr_t *h = q->hdr;
+    lock(h);
+    h->closed = true;
+    h->empty_waiters = 0;
+    pthread_cond_broadcast(&h->not_empty);
+    pthread_mutex_unlock(&h->lock);
+}
+
+size_t shmq_size(shmq_t *q)
+{
+    shm_hdr_t *h = q->hdr;
+    lock(h);
+    size_t count = h->count;
+    pthread_mutex_unlock(&h->lock);
+    return count;
+}
+
+/* Offset where a node of need bytes fits, 0 if the ring is too full */
+static shm_off_t place(shm_hdr_t *h, size_t need)
+{
+    if (!h->count)
+        return h->data + need <= h->size ? h->data : 0;
+    if (h->alloc > h->head) {
+        if (h->alloc + need <= h->size)
+            return h->alloc;
+        return h->data + need <= h->head ? h->data : 0;
+    }
+    return h->alloc + need <= h->head ? h->alloc : 0;
+}
+
+static bool insert_tail(shmq_t *q, const char *s, bool wait)
+{
+    if (!q || !s)
+        return false;
+
+    shm_hdr_t *h = q->hdr;
+    size_t len = strlen(s);
+    size_t need = node_size(len);
+    if (need > h->size - h->data)
+        return false;
+
+    lock(h);
+    shm_off_t off;
+    while (!(off = place(h, need))) {
+        if (!wait) {
+            pthread_mutex_unlock(&h->lock);
+            return false;
+        }
+        wait_on(h, &h->not_full, &h->full_waiters);
+    }
+
+    shm_node_t *node = node_at(q, off);
+    node->next = 0;
+    node->len = len;
+    memcpy(node->str, s, len + 1);
+    if (h->count)
+        node_at(q, h->tail)->next = off;
+    else
+        h->head = off;
+    h->tail = off;
+    h->alloc = off + need;
+    h->count++;
+    h->used += need;
+    if (h->empty_waiters) {
+        h->empty_waiters--;
+        pthread_cond_signal(&h->not_empty);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return true;
+}
+
+bool shmq_try_insert_tail(shmq_t *q, const char *s)
+{
+    return insert_tail(q, s, false);
+}
+
+bool shmq_insert_tail(shmq_t *q, const char *s)
+{
+    return insert_tail(q, s, true);
+}
+
+static bool remove_head(shmq_t *q, char *sp, size_t bufsize, bool wait)
+{
+    if (!q)
+        return false;
+
+    shm_hdr_t *h = q->hdr;
+    lock(h);
+    while (!h->count) {
+        if (!wait || h->closed) {
+            pthread_mutex_unlock(&h->lock);
+            return false;
+        }
+        wait_on(h, &h->not_empty, &h->empty_waiters);
+    }
+
+    shm_node_t *node = node_at(q, h->head);
+    if (sp && bufsize) {
+        size_t len = node->len < bufsize - 1 ? node->len : bufsize - 1;
+        memcpy(sp, node->str, len);
+        sp[len] = '\0';
+    }
+    h->head = node->next;
+    h->used -= node_size(node->len);
+    if (!--h->count) {
+        h->tail = 0;
+        h->alloc = h->data;
+    }
+    if (h->full_waiters && 2 * h->used <= h->size - h->data) {
+        h->full_waiters = 0;
+        pthread_cond_broadcast(&h->not_full);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return true;
+}
+
+bool shmq_try_remove_head(shmq_t *q, char *sp, size_t bufsize)
+{
+    return remove_head(q, sp, bufsize, false);
+}
+
+bool shmq_remove_head(shmq_t *q, char *sp, size_t bufsize)
+{
+    return remove_head(q, sp, bufsize, true);
+}
@@ -0,0 +1,125 @@
+#ifndef LAB0_SHMQ_H
+#define LAB0_SHMQ_H
+
+/* String queue in a POSIX shared-memory segment.
+ *
+ * The segment holds a header and a node area.  Nodes carry their string
+ * inline and link to each other by offset from the start of the segment,
+ * so every process may map the segment at a different address.  Since
+ * nodes are freed in the order they were allocated, the node area is used
+ * as a ring: new nodes go after the newest one, wrapping to the start of
+ * the area when the end is reached.
+ *
+ * All state is guarded by a process-shared robust mutex, with condition
+ * variables for blocking insertions and removals.  A process dying while
+ * holding the lock does not wedge the others.
+ *
+ * Any number of processes, and threads within them, may use a queue at
+ * the same time.  The handle itself comes from the C library allocator.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Size of the segment when none is given */
+#define SHMQ_DEFAULT_SIZE (1 << 20)
+
+typedef struct shmq shmq_t;
+
+/**
+ * shmq_create() - Create a new named queue and map it
+ * @name: shm_open() name, such as "/queue"; must not exist yet
+ * @size: bytes of the segment, header included
+ *
+ * Return: the queue, NULL if the name exists, @size is too small or the
+ * segment could not be created
+ */
+shmq_t *shmq_create(const char *name, size_t size);
+
+/**
+ * shmq_attach() - Map an existing named queue
+ * @name: name the queue was created with
+ *
+ * Return: the queue, NULL if no initialized queue has that name
+ */
+shmq_t *shmq_attach(const char *name);
+
+/**
+ * shmq_detach() - Unmap a queue
+ * @q: queue, may be NULL
+ *
+ * The strings stay in the segment until it is unlinked and unmapped by
+ * every process.
+ */
+void shmq_detach(shmq_t *q);
+
+/**
+ * shmq_unlink() - Remove the name of a queue
+ * @name: name the queue was created with
+ *
+ * Processes that have the queue mapped keep using it.
+ *
+ * Return: true for success, false if there is no such name
+ */
+bool shmq_unlink(const char *name);
+
+/**
+ * shmq_close() - Tell consumers that no more strings will be inserted
+ * @q: queue
+ *
+ * Blocking removals on an empty closed queue return false instead of
+ * waiting.
+ */
+void shmq_close(shmq_t *q);
+
+/**
+ * shmq_size() - Number of strings in a queue
+ * @q: queue
+ *
+ * Return: the number of strings
+ */
+size_t shmq_size(shmq_t *q);
+
+/**
+ * shmq_try_insert_tail() - Insert a copy of a string without waiting
+ * @q: queue
+ * @s: string to be copied into the segment
+ *
+ * Return: true for success, false if there is no room for @s
+ */
+bool shmq_try_insert_tail(shmq_t *q, const char *s);
+
+/**
+ * shmq_insert_tail() - Insert a copy of a string, waiting for room
+ * @q: queue
+ * @s: string to be copied into the segment
+ *
+ * Return: true for success, false if @s can never fit in the segment
+ */
+bool shmq_insert_tail(shmq_t *q, const char *s);
+
+/**
+ * shmq_try_remove_head() - Remove the string at the head without waiting
+ * @q: queue
+ * @sp: buffer receiving up to bufsize - 1 characters of the string plus a
+ *      null terminator, may be NULL
+ * @bufsize: size of @sp
+ *
+ * Same copy contract as q_remove_head().
+ *
+ * Return: true if a string was removed, false if the queue is empty
+ */
+bool shmq_try_remove_head(shmq_t *q, char *sp, size_t bufsize);
+
+/**
+ * shmq_remove_head() - Remove the string at the head, waiting while empty
+ * @q: queue
+ * @sp: buffer as for shmq_try_remove_head()
+ * @bufsize: size of @sp
+ *
+ * Return: true if a string was removed, false if the queue is empty and
+ * closed
+ */
+bool shmq_remove_head(shmq_t *q, char *sp, size_t bufsize);
+
+#endif /* LAB0_SHMQ_H */
@@ -20,7 +20,8 @@ struct pair {
     struct list_head *head, *next;
 };
 
-static size_t stk_size;
+/* Per thread, so that queues can be sorted concurrently */
+static _Thread_local size_t stk_size;
 
 static struct list_head *merge(void *priv,
                                list_cmp_func_t cmp,
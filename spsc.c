@@ -0,0 +1,222 @@
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "spsc.h"
+
+#define CACHE_LINE 64
+
+/* Spin this many times before yielding the CPU while waiting */
+#define SPIN_LIMIT 64
+
+/* Indices run freely and are masked on access, so tail - head is always
+ * the number of strings in the ring.
+ */
+struct spsc {
+    /* Written by the producer */
+    alignas(CACHE_LINE) _Atomic size_t tail;
+    size_t head_cache;
+
+    /* Written by the consumer */
+    alignas(CACHE_LINE) _Atomic size_t head;
+    size_t tail_cache;
+
+    /* Read only after creation, apart from closed */
+    alignas(CACHE_LINE) size_t mask;
+    atomic_bool closed;
+    char **slots;
+};
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void backoff(unsigned *spins)
+{
+    if (++*spins < SPIN_LIMIT) {
+        cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+static char *copy_string(const char *s)
+{
+    size_t len = strlen(s);
+    char *copy = malloc(len + 1);
+    if (copy)
+        memcpy(copy, s, len + 1);
+    return copy;
+}
+
+static void copy_out(char *value, char *sp, size_t bufsize)
+{
+    if (sp && bufsize) {
+        size_t len = strnlen(value, bufsize - 1);
+        memcpy(sp, value, len);
+        sp[len] = '\0';
+    }
+    free(value);
+}
+
+/* Number of free slots seen by the producer, refreshing its copy of head
+ * only when fewer than want slots appear free.
+ */
+static size_t room(spsc_t *q, size_t tail, size_t want)
+{
+    size_t cap = q->mask + 1;
+    if (cap - (tail - q->head_cache) < want)
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+    return cap - (tail - q->head_cache);
+}
+
+/* Number of strings seen by the consumer, see room() */
+static size_t ready(spsc_t *q, size_t head, size_t want)
+{
+    if (q->tail_cache - head < want)
+        q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+    return q->tail_cache - head;
+}
+
+spsc_t *spsc_new(size_t capacity)
+{
+    if (!capacity || capacity > (size_t) 1 << (sizeof(size_t) * 8 - 2))
+        return NULL;
+
+    size_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    spsc_t *q = aligned_alloc(CACHE_LINE, sizeof(spsc_t));
+    char **slots = test_calloc(cap, sizeof(char *));
+    if (!q || !slots) {
+        free(q);
+        free(slots);
+        return NULL;
+    }
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->closed, false);
+    q->head_cache = q->tail_cache = 0;
+    q->mask = cap - 1;
+    q->slots = slots;
+    return q;
+}
+
+void spsc_free(spsc_t *q)
+{
+    if (!q)
+        return;
+    size_t tail = atomic_load(&q->tail);
+    for (size_t i = atomic_load(&q->head); i != tail; i++)
+        free(q->slots[i & q->mask]);
+    free(q->slots);
+    free(q);
+}
+
+void spsc_close(spsc_t *q)
+{
+    atomic_store_explicit(&q->closed, true, memory_order_release);
+}
+
+bool spsc_try_insert_tail(spsc_t *q, const char *s)
+{
+    return spsc_insert_batch(q, &s, 1) == 1;
+}
+
+bool spsc_insert_tail(spsc_t *q, const char *s)
+{
+    if (!q || !s)
+        return false;
+
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned spins = 0;
+    while (!room(q, tail, 1))
+        backoff(&spins);
+
+    char *copy = copy_string(s);
+    if (!copy)
+        return false;
+    q->slots[tail & q->mask] = copy;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+size_t spsc_insert_batch(spsc_t *q, const char *const *s, size_t n)
+{
+    if (!q || !s)
+        return 0;
+
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t free_slots = room(q, tail, n);
+    if (n > free_slots)
+        n = free_slots;
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        char *copy = copy_string(s[i]);
+        if (!copy)
+            break;
+        q->slots[(tail + i) & q->mask] = copy;
+    }
+    if (i)
+        atomic_store_explicit(&q->tail, tail + i, memory_order_release);
+    return i;
+}
+
+bool spsc_try_remove_head(spsc_t *q, char *sp, size_t bufsize)
+{
+    if (!q)
+        return false;
+
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (!ready(q, head, 1))
+        return false;
+
+    char *value = q->slots[head & q->mask];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    copy_out(value, sp, bufsize);
+    return true;
+}
+
+bool spsc_remove_head(spsc_t *q, char *sp, size_t bufsize)
+{
+    if (!q)
+        return false;
+
+    unsigned spins = 0;
+    while (!spsc_try_remove_head(q, sp, bufsize)) {
+        /* Strings inserted before the ring was closed are still taken */
+        if (atomic_load_explicit(&q->closed, memory_order_acquire))
+            return spsc_try_remove_head(q, sp, bufsize);
+        backoff(&spins);
+    }
+    return true;
+}
+
+size_t spsc_remove_batch(spsc_t *q, char **sp, size_t bufsize, size_t n)
+{
+    if (!q)
+        return 0;
+
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t avail = ready(q, head, n);
+    if (n > avail)
+        n = avail;
+
+    /* The slots cannot be reused before head is published */
+    for (size_t i = 0; i < n; i++)
+        copy_out(q->slots[(head + i) & q->mask], sp ? sp[i] : NULL, bufsize);
+    if (n)
+        atomic_store_explicit(&q->head, head + n, memory_order_release);
+    return n;
+}
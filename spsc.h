@@ -0,0 +1,109 @@
+#ifndef LAB0_SPSC_H
+#define LAB0_SPSC_H
+
+/* Bounded single-producer/single-consumer string queue.
+ *
+ * A power-of-two ring of string pointers.  The producer owns the tail
+ * index and the consumer the head index; each lives on its own cache line
+ * together with the owner's cached copy of the other index, so the two
+ * threads only touch each other's line when the ring looks full or empty.
+ * The batch variants publish their index once per batch.
+ *
+ * Exactly one thread may insert and exactly one thread may remove at a
+ * time.  Strings are copied through the test harness, like mpmc.h.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct spsc spsc_t;
+
+/**
+ * spsc_new() - Create an empty ring
+ * @capacity: number of strings the ring holds, rounded up to a power of 2
+ *
+ * Return: the ring, NULL for allocation failed or zero capacity
+ */
+spsc_t *spsc_new(size_t capacity);
+
+/**
+ * spsc_free() - Free a ring and every string still in it
+ * @q: ring, may be NULL
+ */
+void spsc_free(spsc_t *q);
+
+/**
+ * spsc_close() - Tell the consumer that no more strings will be inserted
+ * @q: ring
+ *
+ * Blocking removals on an empty closed ring return false instead of
+ * waiting.  Called by the producer.
+ */
+void spsc_close(spsc_t *q);
+
+/**
+ * spsc_try_insert_tail() - Insert a copy of a string without waiting
+ * @q: ring
+ * @s: string to be copied
+ *
+ * Return: true for success, false if the ring is full or allocation failed
+ */
+bool spsc_try_insert_tail(spsc_t *q, const char *s);
+
+/**
+ * spsc_insert_tail() - Insert a copy of a string, waiting while full
+ * @q: ring
+ * @s: string to be copied
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool spsc_insert_tail(spsc_t *q, const char *s);
+
+/**
+ * spsc_insert_batch() - Insert copies of up to n strings without waiting
+ * @q: ring
+ * @s: strings to be copied
+ * @n: number of strings
+ *
+ * The strings become visible to the consumer together.
+ *
+ * Return: number of strings inserted, a prefix of @s
+ */
+size_t spsc_insert_batch(spsc_t *q, const char *const *s, size_t n);
+
+/**
+ * spsc_try_remove_head() - Remove the string at the head without waiting
+ * @q: ring
+ * @sp: buffer receiving up to bufsize - 1 characters of the string plus a
+ *      null terminator, may be NULL
+ * @bufsize: size of @sp
+ *
+ * Same copy contract as q_remove_head().
+ *
+ * Return: true if a string was removed, false if the ring is empty
+ */
+bool spsc_try_remove_head(spsc_t *q, char *sp, size_t bufsize);
+
+/**
+ * spsc_remove_head() - Remove the string at the head, waiting while empty
+ * @q: ring
+ * @sp: buffer as for spsc_try_remove_head()
+ * @bufsize: size of @sp
+ *
+ * Return: true if a string was removed, false if the ring is empty and
+ * closed
+ */
+bool spsc_remove_head(spsc_t *q, char *sp, size_t bufsize);
+
+/**
+ * spsc_remove_batch() - Remove up to n strings without waiting
+ * @q: ring
+ * @sp: n buffers of bufsize bytes each, filled in order, may be NULL
+ * @bufsize: size of each buffer
+ * @n: maximum number of strings to remove
+ *
+ * Return: number of strings removed
+ */
+size_t spsc_remove_batch(spsc_t *q, char **sp, size_t bufsize, size_t n);
+
+#endif /* LAB0_SPSC_H */
@@ -0,0 +1,212 @@
+/* String comparison kernels with runtime CPU dispatch */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "str_simd.h"
+
+/* Byte difference at the first mismatching position, as memcmp() reports */
+static inline int byte_diff(const unsigned char *a,
+                            const unsigned char *b,
+                            size_t i)
+{
+    return (int) a[i] - (int) b[i];
+}
+
+/* Portable fallback: 8 bytes at a time, byte-wise for the tail */
+static int cmp_scalar(const void *a, const void *b, size_t n)
+{
+    const unsigned char *pa = a, *pb = b;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, pa + i, 8);
+        memcpy(&wb, pb + i, 8);
+        if (wa != wb) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            i += __builtin_ctzll(wa ^ wb) >> 3;
+#else
+            i += __builtin_clzll(wa ^ wb) >> 3;
+#endif
+            return byte_diff(pa, pb, i);
+        }
+    }
+    for (; i < n; i++) {
+        if (pa[i] != pb[i])
+            return byte_diff(pa, pb, i);
+    }
+    return 0;
+}
+
+static bool eq_scalar(const void *a, const void *b, size_t n)
+{
+    const unsigned char *pa = a, *pb = b;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, pa + i, 8);
+        memcpy(&wb, pb + i, 8);
+        if (wa != wb)
+            return false;
+    }
+    for (; i < n; i++) {
+        if (pa[i] != pb[i])
+            return false;
+    }
+    return true;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) static int cmp_sse2(const void *a,
+                                                    const void *b,
+                                                    size_t n)
+{
+    const unsigned char *pa = a, *pb = b;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (pa + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (pb + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (mask != 0xffff)
+            return byte_diff(pa, pb, i + __builtin_ctz(~mask));
+    }
+    return cmp_scalar(pa + i, pb + i, n - i);
+}
+
+__attribute__((target("sse2"))) static bool eq_sse2(const void *a,
+                                                    const void *b,
+                                                    size_t n)
+{
+    const unsigned char *pa = a, *pb = b;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (pa + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (pb + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff)
+            return false;
+    }
+    return eq_scalar(pa + i, pb + i, n - i);
+}
+
+__attribute__((target("avx2"))) static int cmp_avx2(const void *a,
+                                                    const void *b,
+                                                    size_t n)
+{
+    const unsigned char *pa = a, *pb = b;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *) (pa + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *) (pb + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (mask != 0xffffffffU)
+            return byte_diff(pa, pb, i + __builtin_ctz(~mask));
+    }
+    return cmp_sse2(pa + i, pb + i, n - i);
+}
+
+__attribute__((target("avx2"))) static bool eq_avx2(const void *a,
+                                                    const void *b,
+                                                    size_t n)
+{
+    const unsigned char *pa = a, *pb = b;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *) (pa + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *) (pb + i));
+        if ((unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) !=
+            0xffffffffU)
+            return false;
+    }
+    return eq_sse2(pa + i, pb + i, n - i);
+}
+#endif
+
+static int cmp_libc(const void *a, const void *b, size_t n)
+{
+    return memcmp(a, b, n);
+}
+
+static bool eq_libc(const void *a, const void *b, size_t n)
+{
+    return !memcmp(a, b, n);
+}
+
+int (*str_simd_cmp)(const void *, const void *, size_t) = cmp_libc;
+bool (*str_simd_eq)(const void *, const void *, size_t) = eq_libc;
+
+static str_simd_t current_kind = STR_SIMD_LIBC;
+
+static bool cpu_supports(str_simd_t kind)
+{
+    switch (kind) {
+    case STR_SIMD_LIBC:
+    case STR_SIMD_SCALAR:
+        return true;
+#ifdef HAVE_X86_SIMD
+    case STR_SIMD_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case STR_SIMD_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool str_simd_select(str_simd_t kind)
+{
+    if (!cpu_supports(kind))
+        return false;
+
+    switch (kind) {
+#ifdef HAVE_X86_SIMD
+    case STR_SIMD_AVX2:
+        str_simd_cmp = cmp_avx2;
+        str_simd_eq = eq_avx2;
+        break;
+    case STR_SIMD_SSE2:
+        str_simd_cmp = cmp_sse2;
+        str_simd_eq = eq_sse2;
+        break;
+#endif
+    case STR_SIMD_SCALAR:
+        str_simd_cmp = cmp_scalar;
+        str_simd_eq = eq_scalar;
+        break;
+    default:
+        str_simd_cmp = cmp_libc;
+        str_simd_eq = eq_libc;
+        break;
+    }
+    current_kind = kind;
+    return true;
+}
+
+/* Pick AVX2 if the CPU has it, once at load time so that the kernel
+ * pointers are never written while worker threads read them.  The SSE2
+ * and scalar kernels are slower than memcmp() at every length measured
+ * by bench/str_cmp, so without AVX2 everything stays with memcmp().
+ */
+__attribute__((constructor)) static void resolve()
+{
+    if (!str_simd_select(STR_SIMD_AVX2))
+        str_simd_select(STR_SIMD_LIBC);
+}
+
+str_simd_t str_simd_current()
+{
+    return current_kind;
+}
+
+const char *str_simd_name(str_simd_t kind)
+{
+    static const char *names[] = {"memcmp", "scalar", "sse2", "avx2"};
+    return kind <= STR_SIMD_AVX2 ? names[kind] : "unknown";
+}
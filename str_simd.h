@@ -0,0 +1,66 @@
+#ifndef LAB0_STR_SIMD_H
+#define LAB0_STR_SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Byte string comparison kernels used by the queue hot loops.
+ *
+ * AVX2 is used if the CPU has it, otherwise memcmp(); the choice is made
+ * when the program is loaded, before any thread can call a kernel.  The
+ * SSE2 and portable scalar kernels are only selected explicitly, to
+ * benchmark them.
+ */
+
+/* STR_SIMD_LIBC hands every comparison to memcmp() */
+typedef enum {
+    STR_SIMD_LIBC,
+    STR_SIMD_SCALAR,
+    STR_SIMD_SSE2,
+    STR_SIMD_AVX2
+} str_simd_t;
+
+/* The inline comparisons of queue.h call these two from user code, so
+ * libqueue.so exports them
+ */
+#pragma GCC visibility push(default)
+
+/* Compare n bytes of a and b. Same sign convention as memcmp() */
+extern int (*str_simd_cmp)(const void *a, const void *b, size_t n);
+
+/* Return whether the first n bytes of a and b are identical */
+extern bool (*str_simd_eq)(const void *a, const void *b, size_t n);
+
+#pragma GCC visibility pop
+
+/* Comparisons shorter than this are left to memcmp(), which the C library
+ * already vectorizes; bench/str_cmp only shows AVX2 clearly ahead of it
+ * from 2 KiB on
+ */
+#define STR_SIMD_MIN_BYTES 2048
+
+/* Compare n bytes of a and b with memcmp() or the kernel, by length */
+static inline int str_bytes_cmp(const void *a, const void *b, size_t n)
+{
+    return n < STR_SIMD_MIN_BYTES ? memcmp(a, b, n) : str_simd_cmp(a, b, n);
+}
+
+/* Return whether n bytes of a and b are identical, see str_bytes_cmp() */
+static inline bool str_bytes_eq(const void *a, const void *b, size_t n)
+{
+    return n < STR_SIMD_MIN_BYTES ? !memcmp(a, b, n) : str_simd_eq(a, b, n);
+}
+
+/* Force a kernel.  Return false if the CPU does not support it.
+ * Not to be called while other threads compare strings.
+ */
+bool str_simd_select(str_simd_t kind);
+
+/* Kernel currently in use */
+str_simd_t str_simd_current();
+
+/* Human readable name of a kernel */
+const char *str_simd_name(str_simd_t kind);
+
+#endif /* LAB0_STR_SIMD_H */
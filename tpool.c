@@ -0,0 +1,245 @@
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "list.h"
+#include "tpool.h"
+#include "wsdeque.h"
+
+#define DEQUE_CAPACITY 64
+
+typedef struct {
+    tpool_fn_t fn;
+    void *arg;
+    struct list_head list; /* Injection list, unused in deques */
+} task_t;
+
+typedef struct {
+    tpool_t *pool;
+    wsdeque_t *deque;
+    pthread_t tid;
+    unsigned seed;
+} worker_t;
+
+struct tpool {
+    int nthreads;
+    worker_t *workers;
+
+    /* Tasks submitted but not started, and not yet finished */
+    atomic_long queued, pending;
+
+    /* Workers about to sleep or sleeping.  A submitter increments queued
+     * before it reads sleepers and a worker increments sleepers before it
+     * reads queued, so at least one of them sees the other.
+     */
+    atomic_int sleepers;
+
+    /* Protects inject and stop */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv, done_cv;
+    struct list_head inject;
+    atomic_long injected;
+    bool stop;
+};
+
+static _Thread_local worker_t *self;
+
+/* Next task for worker w: own deque, injection list, then other deques */
+static task_t *find_task(worker_t *w)
+{
+    tpool_t *pool = w->pool;
+    task_t *t = wsdeque_pop(w->deque);
+    if (t)
+        return t;
+
+    if (atomic_load(&pool->injected)) {
+        pthread_mutex_lock(&pool->lock);
+        if (!list_empty(&pool->inject)) {
+            t = list_first_entry(&pool->inject, task_t, list);
+            list_del(&t->list);
+            atomic_fetch_sub(&pool->injected, 1);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (t)
+            return t;
+    }
+
+    int n = pool->nthreads;
+    int start = rand_r(&w->seed) % n;
+    for (int i = 0; i < n; i++) {
+        worker_t *victim = &pool->workers[(start + i) % n];
+        if (victim != w && (t = wsdeque_steal(victim->deque)))
+            return t;
+    }
+    return NULL;
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+    tpool_t *pool = w->pool;
+    self = w;
+
+    for (;;) {
+        task_t *t = find_task(w);
+        if (t) {
+            atomic_fetch_sub(&pool->queued, 1);
+            t->fn(t->arg);
+            free(t);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->done_cv);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        bool slept = false;
+        while (!pool->stop && !atomic_load(&pool->queued)) {
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+            slept = true;
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        bool stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            break;
+
+        /* A task is still being published, or was stolen by another worker
+         * that has not started it yet.
+         */
+        if (!slept)
+            sched_yield();
+    }
+    return NULL;
+}
+
+/* Stop the first started workers and release everything */
+static void destroy(tpool_t *pool, int started)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(pool->workers[i].tid, NULL);
+    for (int i = 0; i < pool->nthreads; i++)
+        wsdeque_free(pool->workers[i].deque);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    free(pool->workers);
+    free(pool);
+}
+
+tpool_t *tpool_new(int nthreads)
+{
+    if (nthreads < 1)
+        return NULL;
+
+    tpool_t *pool = malloc(sizeof(tpool_t));
+    if (!pool)
+        return NULL;
+    pool->workers = calloc(nthreads, sizeof(worker_t));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    pool->nthreads = nthreads;
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->injected, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+    INIT_LIST_HEAD(&pool->inject);
+    pool->stop = false;
+
+    for (int i = 0; i < nthreads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].seed = i + 1;
+        pool->workers[i].deque = wsdeque_new(DEQUE_CAPACITY);
+        if (!pool->workers[i].deque) {
+            destroy(pool, 0);
+            return NULL;
+        }
+    }
+
+    /* Workers inherit the blocked signal mask */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int started = 0;
+    while (started < nthreads &&
+           !pthread_create(&pool->workers[started].tid, NULL, worker_main,
+                           &pool->workers[started]))
+        started++;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (started != nthreads) {
+        destroy(pool, started);
+        return NULL;
+    }
+    return pool;
+}
+
+void tpool_free(tpool_t *pool)
+{
+    if (!pool)
+        return;
+    tpool_wait(pool);
+    destroy(pool, pool->nthreads);
+}
+
+int tpool_size(const tpool_t *pool)
+{
+    return pool->nthreads;
+}
+
+bool tpool_submit(tpool_t *pool, tpool_fn_t fn, void *arg)
+{
+    task_t *t = malloc(sizeof(task_t));
+    if (!t)
+        return false;
+    t->fn = fn;
+    t->arg = arg;
+
+    /* Count the task before any worker can finish it */
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+
+    if (self && self->pool == pool) {
+        if (!wsdeque_push(self->deque, t)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            atomic_fetch_sub(&pool->pending, 1);
+            free(t);
+            return false;
+        }
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        list_add_tail(&t->list, &pool->inject);
+        atomic_fetch_add(&pool->injected, 1);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (atomic_load(&pool->sleepers)) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->work_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return true;
+}
+
+void tpool_wait(tpool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending))
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
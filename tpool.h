@@ -0,0 +1,69 @@
+#ifndef LAB0_TPOOL_H
+#define LAB0_TPOOL_H
+
+/* Work-stealing thread pool.
+ *
+ * Every worker owns a wsdeque.h deque.  Tasks submitted from inside a task
+ * go to the deque of the worker running it; tasks submitted from any other
+ * thread go to a shared injection list.  An idle worker first drains its
+ * own deque, then the injection list, then steals from the other workers,
+ * and sleeps when there is nothing left anywhere.
+ *
+ * Workers run with every signal blocked, so SIGALRM and friends are always
+ * delivered to the thread that created the pool.
+ */
+
+#include <stdbool.h>
+
+#pragma GCC visibility push(default)
+
+typedef void (*tpool_fn_t)(void *arg);
+
+typedef struct tpool tpool_t;
+
+/**
+ * tpool_new() - Start a pool of worker threads
+ * @nthreads: number of workers, at least 1
+ *
+ * Return: the pool, NULL if it could not be started
+ */
+tpool_t *tpool_new(int nthreads);
+
+/**
+ * tpool_free() - Wait for every task, then stop the workers
+ * @pool: pool, may be NULL
+ */
+void tpool_free(tpool_t *pool);
+
+/**
+ * tpool_size() - Number of workers of a pool
+ * @pool: pool
+ *
+ * Return: the number of workers
+ */
+int tpool_size(const tpool_t *pool);
+
+/**
+ * tpool_submit() - Schedule fn(arg) on a pool
+ * @pool: pool
+ * @fn: task function
+ * @arg: argument passed to @fn
+ *
+ * May be called from any thread, including from inside a task.
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool tpool_submit(tpool_t *pool, tpool_fn_t fn, void *arg);
+
+/**
+ * tpool_wait() - Wait until every submitted task has finished
+ * @pool: pool
+ *
+ * Tasks submitted by running tasks are waited for as well.  Must not be
+ * called from inside a task.
+ */
+void tpool_wait(tpool_t *pool);
+
+#pragma GCC visibility pop
+
+#endif /* LAB0_TPOOL_H */
@@ -0,0 +1,55 @@
+# Test of integer and blob element types
+option fail 0
+option malloc 0
+option type int
+new
+ih 3
+ih -7
+it 12
+it 0x10
+ih 9223372036854775807
+it -9223372036854775808
+sort
+rh -9223372036854775808
+rh -7
+rt 9223372036854775807
+option descend 1
+sort
+rh 16
+rt 3
+option descend 0
+it 70000
+ih 300
+it 2
+ih 65536
+sort
+rh 2
+rh 12
+rh 300
+rh 65536
+rh 70000
+it RAND 10000
+sort
+free
+option type blob
+new
+ih a\x00b
+ih a
+ih a\x00
+it \x00\x00
+it z\\y
+sort
+rh \x00\x00
+rh a
+rh a\x00
+rh a\x00b
+rh z\\y
+it RAND 1000
+sort
+dedup
+free
+option type str
+new
+ih dolphin
+rh dolphin
+free
@@ -0,0 +1,37 @@
+# Test of copy-on-write snapshots of queues
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+ih dolphin
+it bear
+it meerkat
+clone
+sort
+dedup
+rh dolphin
+rh gerbil
+rh meerkat
+prev
+rh dolphin
+rh bear
+clone
+descend
+rh meerkat
+free
+rh gerbil
+rh bear
+rh meerkat
+free
+free
+new
+it RAND 1000
+clone
+clone
+sort
+prev
+reverseK 3
+free
+free
+free
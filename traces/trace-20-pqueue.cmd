@@ -0,0 +1,53 @@
+# Test of the priority queue commands
+option fail 0
+option malloc 0
+pqpush gerbil
+pqpush bear
+pqpush dolphin
+pqpush bear
+pqpush meerkat
+pqsize
+pqmin bear
+pqmax meerkat
+pqmin bear
+pqpush aardvark
+pqmin aardvark
+pqmax gerbil
+pqmax dolphin
+new
+ih zebra
+ih yak
+it aardvark
+pqload
+pqmin aardvark
+pqmax zebra
+pqfree
+option type int
+pqpush 5
+pqpush -3
+pqpush 42
+pqpush 7 3
+pqmin -3
+pqmax 42
+pqmin 5
+pqmin 7
+pqfree
+pqpush 3
+pqpush 9
+pqpush 1
+pqpush 6
+pqpush 4
+pqpush 8
+pqpush 2
+pqmin 1
+pqmax 9
+pqmin 2
+pqmax 8
+pqmin 3
+pqmax 6
+pqmin 4
+pqpush RAND 2000
+pqmin
+pqmax
+pqfree
+free
@@ -0,0 +1,28 @@
+# Test of sorting every queue of the chain in parallel
+option fail 0
+option malloc 0
+option threads 3
+new
+it RAND 5000
+new
+ih dolphin
+ih bear
+ih gerbil
+new
+new
+it RAND 5000
+psort
+prev
+prev
+rh bear
+rh dolphin
+rh gerbil
+option descend 1
+option threads 1
+psort
+option threads 4
+psort
+free
+free
+free
+free
@@ -0,0 +1,28 @@
+# Test of running commands on every queue of the chain in parallel
+option fail 0
+option malloc 0
+option threads 3
+new
+new
+new
+new
+parallel it RAND 2000
+parallel ih gerbil 2
+parallel sort
+parallel dedup
+parallel reverse
+parallel size
+option descend 1
+parallel sort
+parallel it zebra
+parallel rt zebra
+parallel reverseK 3
+parallel swap
+parallel dm
+parallel shuffle
+parallel ascend
+parallel descend
+free
+free
+free
+free
@@ -0,0 +1,58 @@
+# Test of merging the queues of the chain as a parallel tree reduction
+option fail 0
+option malloc 0
+option merge_threads 3
+new
+ih c
+ih a
+new
+ih d
+ih b
+ih a
+new
+new
+ih e
+ih c
+new
+ih b
+merge
+rh a
+rh a
+rh b
+rh b
+rh c
+rh c
+rh d
+rh e
+size 0
+free
+option descend 1
+new
+it RAND 1000
+sort
+new
+it RAND 700
+sort
+new
+new
+it RAND 1500
+sort
+new
+it RAND 30
+sort
+new
+it RAND 999
+sort
+merge
+size 4229
+option merge_threads 1
+new
+it RAND 500
+sort
+merge
+option merge_threads 0
+new
+it RAND 100
+sort
+merge
+free
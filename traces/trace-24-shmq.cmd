@@ -0,0 +1,28 @@
+# Test of the shared-memory queue
+option fail 0
+option malloc 0
+shmcreate lab0-trace-24 4096
+shmsize
+shmit dolphin
+shmit bear
+shmit gerbil 2
+shmsize
+shmrh dolphin
+shmrh bear
+shmit RAND 50
+shmsize
+shmrh gerbil
+shmrh gerbil
+shmdetach
+shmcreate lab0-trace-24 512
+shmit abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz 3
+shmrh abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz
+shmit abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz
+shmrh abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz
+shmrh abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz
+shmit zebra 2
+shmrh abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz
+shmrh zebra
+shmrh zebra
+shmsize
+shmdetach
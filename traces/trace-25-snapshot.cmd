@@ -0,0 +1,48 @@
+# Test of saving queues to snapshot files and loading them back
+option fail 0
+option malloc 0
+new
+it dolphin
+it bear
+it gerbil
+it RAND 997
+save /tmp/qtest.snapshot
+load /tmp/qtest.snapshot
+size 1000
+rh dolphin
+rh bear
+rh gerbil
+sort
+prev
+sort
+merge
+size 1997
+free
+new
+save /tmp/qtest.snapshot
+load /tmp/qtest.snapshot
+size 0
+free
+free
+option type int
+new
+it 5
+it -7
+it 9223372036854775807
+save /tmp/qtest.snapshot
+load /tmp/qtest.snapshot
+rh 5
+rh -7
+rh 9223372036854775807
+free
+free
+option type blob
+new
+it a\x00b
+it \x01\x02\x03\x04\x05\x06\x07\x08\x09
+save /tmp/qtest.snapshot
+load /tmp/qtest.snapshot
+rh a\x00b
+rh \x01\x02\x03\x04\x05\x06\x07\x08\x09
+free
+free
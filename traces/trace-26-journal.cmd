@@ -0,0 +1,50 @@
+# Test of journaling a queue and recovering it from the journal
+option fail 0
+option malloc 0
+new
+jopen /tmp/qtest.journal
+ih cherry
+it apple
+it banana
+it date
+it apple
+sort
+dedup
+reverse
+it fig
+rh date
+swap
+reverseK 2
+jstat
+jclose
+free
+new
+jopen /tmp/qtest.journal
+size 3
+rh cherry
+rh banana
+shuffle
+it grape
+jclose
+free
+option journal_compact 1
+option journal_group 4
+new
+jopen /tmp/qtest.journal
+size 2
+rh fig
+rh grape
+it RAND 300
+jstat
+option descend 1
+sort
+jclose
+free
+new
+jopen /tmp/qtest.journal
+size 300
+option descend 0
+sort
+dm
+jdrop /tmp/qtest.journal
+free
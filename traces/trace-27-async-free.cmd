@@ -0,0 +1,28 @@
+# Test of freeing queues on the background reclaimer
+option fail 0
+option malloc 0
+option async_free 1
+new
+ih dolphin
+ih bear
+it gerbil
+clone
+free
+rh bear
+rh dolphin
+rh gerbil
+free
+new
+it RAND 100000
+new
+ih RAND 50000
+free
+free
+new
+ih RAND 1000
+clone
+free
+it meerkat
+reclaim
+free
+option async_free 0
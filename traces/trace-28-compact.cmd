@@ -0,0 +1,42 @@
+# Test of relocating the elements of queues in list order
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+it gerbil
+compact
+rh bear
+rh dolphin
+rh gerbil
+compact
+it RAND 1000
+sort
+compact
+clone
+compact
+rh
+free
+compact
+free
+option type int
+new
+it RAND 1000
+sort
+compact
+free
+option type str
+# Blocks cached by the harness are bypassed, the copies come out in order
+option alloc_cache 1
+new
+it RAND 2000
+sort
+free
+new
+it RAND 500
+sort
+compact
+rh
+compact
+free
+option alloc_cache 0
@@ -0,0 +1,80 @@
+# Test of the compact queue
+option fail 0
+option malloc 0
+cqit bear
+cqit dolphin
+cqih gerbil
+cqit bear
+cqit zebra
+cqsize
+cqop sort
+cqrh bear
+cqrh bear
+cqrh dolphin
+cqop reverse
+cqrh zebra
+cqrt gerbil
+cqit 1
+cqit 2
+cqit 3
+cqit 4
+cqit 5
+cqop swap
+cqop reverseK 3
+cqrh 4
+cqrh 1
+cqrh 2
+cqrh 3
+cqrh 5
+cqit 3
+cqit 1
+cqit 2
+cqop ascend
+cqrh 1
+cqrh 2
+cqit 5
+cqit 1
+cqit 4
+cqit 2
+cqop descend
+cqrh 5
+cqrh 4
+cqrh 2
+cqit a
+cqit b
+cqit b
+cqit c
+cqit d
+cqop dedup
+cqop dm
+cqrh a
+cqrh d
+cqfree
+new
+it RAND 2000
+cqload
+cqop sort
+sort
+cqstore
+merge
+cqfree
+free
+option type int
+cqit -5
+cqit 7
+cqih 100
+cqop sort
+cqrt 100
+cqrh -5
+cqrh 7
+cqit RAND 1000
+cqop sort
+new
+cqstore
+new
+it RAND 1000
+sort
+merge
+free
+cqfree
+option type str
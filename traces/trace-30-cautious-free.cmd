@@ -0,0 +1,11 @@
+# Test of freeing big queues with every free validated
+option fail 0
+option malloc 0
+new
+it dolphin 1000000
+new
+ih RAND 200000
+clone
+free
+free
+free
@@ -0,0 +1,32 @@
+# Test of queue operations with payloads poisoned only at their ends or not at all
+option fail 0
+option malloc 0
+option poison edges
+new
+ih aardvark
+it abcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghij
+ih RAND 50
+reverse
+rh abcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghij
+rh aardvark
+sort
+dm
+free
+option poison 0
+new
+it dolphin 1000
+ih gerbil
+dedup
+size
+rh gerbil
+free
+option type blob
+option poison 1
+new
+ih \x00\x01\x02
+it \xffzebra
+rh \x00\x01\x02
+rt \xffzebra
+free
+option type str
+option poison full
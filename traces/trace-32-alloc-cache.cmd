@@ -0,0 +1,30 @@
+# Test of queue operations with freed blocks recycled by the harness
+option fail 0
+option malloc 0
+option alloc_cache 1
+new
+ih RAND 1000
+it gerbil 500
+rh
+rt gerbil
+sort
+reverse
+dedup
+free
+new
+ih dolphin
+ih bear
+it meerkat
+reverse
+rh meerkat
+rh dolphin
+rh bear
+it RAND 2000
+free
+allocstats
+option alloc_cache 0
+allocstats
+new
+ih zebra
+rh zebra
+free
@@ -0,0 +1,24 @@
+# Test of profiling allocations per call site
+option fail 0
+option malloc 0
+option alloc_profile 1
+new
+ih RAND 500
+it gerbil 300
+clone
+dedup
+free
+free
+new
+ih dolphin
+ih bear
+it meerkat
+rh bear
+rt meerkat
+allocstats 3
+option alloc_profile 0
+it zebra
+rh dolphin
+rh zebra
+free
+allocstats
@@ -0,0 +1,19 @@
+# Test of the memory accounting of every command
+option fail 0
+option malloc 0
+option memstats 1
+new
+ih RAND 1000
+sort
+it dolphin 100
+time reverse
+dedup
+free
+option memstats 0
+new
+time ih gerbil 10
+time
+free
+option memstats 1
+new
+ih bear
@@ -0,0 +1,18 @@
+# Test of the harness shared by threads allocating at once
+option fail 0
+option malloc 0
+stress 4 5000
+stress 16 1000
+stress 64 200
+new
+new
+new
+new
+parallel ih RAND 2000
+parallel it dolphin 500
+parallel sort
+parallel rh
+free
+free
+free
+free
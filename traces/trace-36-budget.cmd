@@ -0,0 +1,23 @@
+# Test of sub-second time limits and per-command time budgets
+option fail 0
+option malloc 0
+option limit_ms 500
+option budget_ms 5000
+option budget_fail 1
+new
+ih RAND 10000
+sort
+reverse
+time dedup
+free
+option budget_ms 1
+option budget_fail 0
+new
+ih RAND 100000
+sort
+free
+option budget_ms 0
+option limit_ms 1000
+new
+ih dolphin 10
+free
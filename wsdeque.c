@@ -0,0 +1,147 @@
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "wsdeque.h"
+
+#define CACHE_LINE 64
+
+typedef struct ws_array {
+    struct ws_array *retired; /* Older buffers, freed with the deque */
+    int64_t mask;
+    _Atomic(void *) slot[];
+} ws_array_t;
+
+/* Indices only grow; bottom - top is the number of items */
+struct wsdeque {
+    alignas(CACHE_LINE) _Atomic int64_t top;
+    alignas(CACHE_LINE) _Atomic int64_t bottom;
+    _Atomic(ws_array_t *) array;
+};
+
+static ws_array_t *array_new(int64_t size)
+{
+    ws_array_t *a = malloc(sizeof(ws_array_t) + size * sizeof(void *));
+    if (a) {
+        a->retired = NULL;
+        a->mask = size - 1;
+    }
+    return a;
+}
+
+static inline void *array_get(ws_array_t *a, int64_t i)
+{
+    return atomic_load_explicit(&a->slot[i & a->mask], memory_order_relaxed);
+}
+
+static inline void array_put(ws_array_t *a, int64_t i, void *item)
+{
+    atomic_store_explicit(&a->slot[i & a->mask], item, memory_order_relaxed);
+}
+
+/* Copy the live range [top, bottom) into a buffer twice as large */
+static ws_array_t *grow(wsdeque_t *q,
+                        ws_array_t *a,
+                        int64_t top,
+                        int64_t bottom)
+{
+    ws_array_t *b = array_new(2 * (a->mask + 1));
+    if (!b)
+        return NULL;
+    for (int64_t i = top; i < bottom; i++)
+        array_put(b, i, array_get(a, i));
+    b->retired = a;
+    atomic_store_explicit(&q->array, b, memory_order_release);
+    return b;
+}
+
+wsdeque_t *wsdeque_new(size_t capacity)
+{
+    int64_t size = 1;
+    while ((size_t) size < capacity)
+        size <<= 1;
+
+    wsdeque_t *q = aligned_alloc(CACHE_LINE, sizeof(wsdeque_t));
+    ws_array_t *a = array_new(size);
+    if (!q || !a) {
+        free(q);
+        free(a);
+        return NULL;
+    }
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, a);
+    return q;
+}
+
+void wsdeque_free(wsdeque_t *q)
+{
+    if (!q)
+        return;
+    ws_array_t *a = atomic_load(&q->array);
+    while (a) {
+        ws_array_t *older = a->retired;
+        free(a);
+        a = older;
+    }
+    free(q);
+}
+
+bool wsdeque_push(wsdeque_t *q, void *item)
+{
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    ws_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    if (b - t > a->mask) {
+        a = grow(q, a, t, b);
+        if (!a)
+            return false;
+    }
+    array_put(a, b, item);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+void *wsdeque_pop(wsdeque_t *q)
+{
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    ws_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if (t > b) {
+        /* Empty */
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void *item = array_get(a, b);
+    if (t == b) {
+        /* Last item: race the thieves for it */
+        if (!atomic_compare_exchange_strong_explicit(
+                &q->top, &t, t + 1, memory_order_seq_cst,
+                memory_order_relaxed))
+            item = NULL;
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+void *wsdeque_steal(wsdeque_t *q)
+{
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b)
+        return NULL;
+
+    ws_array_t *a = atomic_load_explicit(&q->array, memory_order_acquire);
+    void *item = array_get(a, t);
+    if (!atomic_compare_exchange_strong_explicit(
+            &q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return item;
+}
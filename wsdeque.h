@@ -0,0 +1,61 @@
+#ifndef LAB0_WSDEQUE_H
+#define LAB0_WSDEQUE_H
+
+/* Chase-Lev work-stealing deque.
+ *
+ * One owner thread pushes and pops pointers at the bottom end in LIFO
+ * order, while any number of thieves take them from the top end in FIFO
+ * order.  The owner only synchronizes with thieves when the deque is
+ * nearly empty.  The circular buffer doubles when full; replaced buffers
+ * are kept until the deque is freed because a thief may still read them.
+ *
+ * This follows "Correct and Efficient Work-Stealing for Weak Memory
+ * Models" (Le, Pop, Cohen and Zappa Nardelli, PPoPP 2013).
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct wsdeque wsdeque_t;
+
+/**
+ * wsdeque_new() - Create an empty deque
+ * @capacity: initial capacity, rounded up to a power of 2
+ *
+ * Return: the deque, NULL for allocation failed
+ */
+wsdeque_t *wsdeque_new(size_t capacity);
+
+/**
+ * wsdeque_free() - Free a deque
+ * @q: deque, may be NULL.  Items still in it are not touched.
+ */
+void wsdeque_free(wsdeque_t *q);
+
+/**
+ * wsdeque_push() - Push an item at the bottom.  Owner only.
+ * @q: deque
+ * @item: non-NULL item
+ *
+ * Return: true for success, false if growing the buffer failed
+ */
+bool wsdeque_push(wsdeque_t *q, void *item);
+
+/**
+ * wsdeque_pop() - Pop the item at the bottom.  Owner only.
+ * @q: deque
+ *
+ * Return: the most recently pushed item, NULL if the deque is empty
+ */
+void *wsdeque_pop(wsdeque_t *q);
+
+/**
+ * wsdeque_steal() - Take the item at the top.  Any thread.
+ * @q: deque
+ *
+ * Return: the oldest item, NULL if the deque is empty or another thread
+ * won the race for it
+ */
+void *wsdeque_steal(wsdeque_t *q);
+
+#endif /* LAB0_WSDEQUE_H */